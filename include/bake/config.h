@@ -41,6 +41,8 @@ typedef struct bake_config {
     bool optimizations;
     bool coverage;
     bool strict;
+    uint32_t jobs; /* number of projects / files that may be built in parallel */
+    char *cache; /* object cache directory, NULL if cache is disabled */
     corto_ll variables;
 } bake_config;
 
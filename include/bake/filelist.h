@@ -27,15 +27,32 @@
 typedef struct bake_file {
     char *name;
     char *offset;
-    uint64_t timestamp;
+    uint64_t timestamp; /* modified time in nanoseconds, 0 if file doesn't exist */
 } bake_file;
 
 typedef struct bake_filelist {
+    char *root; /* directory relative to which files are resolved */
     char *pattern;
-    corto_ll files;
+    bake_file **files; /* files may be shared between lists, don't modify */
+    uint32_t count;
+    uint32_t size;
+    struct bake_arena_s *arena; /* memory from which files are allocated */
     int16_t (*set)(const char *pattern);
+
+    /* Aggregates, maintained as files are added to the list */
+    uint64_t newest; /* most recent timestamp of existing files */
+    uint64_t oldest; /* least recent timestamp of existing files */
+    bool missing; /* true if list contains a file that does not exist */
 } bake_filelist;
 
+/** Create a new filelist.
+ * Files in the filelist are stored relative to the specified path. If a path is
+ * not specified, files are resolved relative to the working directory.
+ *
+ * @param path The root directory of the filelist (typically the project path).
+ * @param pattern An optional pattern with which to populate the filelist.
+ * @return The new filelist, or NULL if failed.
+ */
 bake_filelist* bake_filelist_new(
     const char *path, const char *pattern);
 
@@ -49,6 +66,16 @@ int16_t bake_filelist_set(
 corto_iter bake_filelist_iter(
     bake_filelist *fl);
 
+/** Get file from filelist by index.
+ *
+ * @param fl The filelist.
+ * @param index Index of the file.
+ * @return The file, or NULL if index is out of bounds.
+ */
+bake_file* bake_filelist_get(
+    bake_filelist *fl,
+    uint32_t index);
+
 bake_file* bake_filelist_add(
     bake_filelist *fl,
     const char *filename);
@@ -64,3 +91,19 @@ int16_t bake_filelist_addList(
 
 uint64_t bake_filelist_count(
     bake_filelist *fl);
+
+/** Recompute aggregated timestamps of filelist.
+ * This must be called after timestamps of files in the list changed.
+ *
+ * @param fl The filelist.
+ */
+void bake_filelist_refresh(
+    bake_filelist *fl);
+
+/** Read timestamps of files in filelist again, and recompute aggregates.
+ * This must be called after an action rewrote the files in the list.
+ *
+ * @param fl The filelist.
+ */
+void bake_filelist_update(
+    bake_filelist *fl);
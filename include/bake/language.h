@@ -64,6 +64,8 @@ struct bake_language_s {
     bake_rule_clean_cb clean_cb;
 
     corto_ll nodes;
+    corto_rb node_index; /* nodes by name, for fast lookup */
+    corto_ll dependency_rules;
     int16_t error;
 };
 
@@ -95,6 +97,17 @@ void bake_language_pattern(
  * for the specified sources. "n" means that for each source there is a target.
  * "pattern" indicate s
  *
+ * Files are passed to the action relative to the project directory. The
+ * working directory of bake is not changed while building a project, so
+ * actions should run commands with the 'exec' callback of the language, which
+ * runs commands from the project directory.
+ *
+ * Actions of a rule with a mapped target are invoked for different inputs in
+ * parallel, from multiple threads, so they must be reentrant. A failing command
+ * started with 'exec' fails only the input it was run for. Actions that set the
+ * error flag of the project themselves are only checked after all inputs of
+ * the rule have been processed.
+ *
  * @param l The language object.
  * @param name The name of the rule
  * @param source A pattern indicating a source.
@@ -114,11 +127,20 @@ void bake_language_rule(
  * this feature is to rebuild source files when one of the included header files
  * change.
  *
+ * A dependency rule applies to the rule with the same name, which must have a
+ * mapped target. The dep_mapping maps each input of that rule to a make-style
+ * dependency file (as emitted by compilers with -MMD). If the dependency file
+ * does not exist, the action is invoked with the input and dependency file to
+ * generate it. A target is rebuilt when any of the files listed in its
+ * dependency file changed. Parsed dependency files are cached in the build
+ * database of the project. A target that was built before and has no
+ * dependency file only depends on its input.
+ *
  * @param l The language object.
- * @param target The target for which to specify the dependencies.
- * @param dependencies A target indicating the source of the dependency information.
- * @param dep_mapping The generated target files for the rule.
- * @param action The action to generate target from source.
+ * @param target The rule for which to specify the dependencies.
+ * @param deps Deprecated, ignored. Dependency files are found with dep_mapping.
+ * @param dep_mapping Map from rule input to dependency file.
+ * @param action The action to generate a dependency file (may be NULL).
  */
 void bake_language_dependency_rule(
     bake_language *l,
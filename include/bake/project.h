@@ -81,6 +81,10 @@ typedef struct bake_project {
     bool error;
     bool freshly_baked;
     bool changed;
+    struct bake_db_s *db; /* build database, loaded when project is built */
+    struct bake_dircache_s *dircache; /* directory listings, valid during build */
+    bool dependencies_loaded; /* link list & dependee config are loaded */
+    uint64_t use_hash; /* contents of used packages, signs the link rule */
 
     /* Should project be rebuilt (managed by bake action) */
     bool artefact_outdated;
@@ -90,6 +94,7 @@ typedef struct bake_project {
     int unresolved_dependencies; /* number of dependencies still to be built */
     corto_ll dependents; /* projects that depend on this project */
     bool built;
+    bool excluded; /* project is skipped by walk */
 
     /* Files to be cleaned other than objects and artefact (populated by language binding) */
     corto_ll files_to_clean;
@@ -49,7 +49,8 @@ typedef enum bake_rule_targetKind {
 
 typedef enum bake_rule_kind {
     BAKE_RULE_PATTERN,
-    BAKE_RULE_RULE
+    BAKE_RULE_RULE,
+    BAKE_RULE_DEPENDENCY_RULE
 } bake_rule_kind;
 
 typedef struct bake_rule_target {
@@ -77,12 +78,15 @@ typedef struct bake_rule {
     const char *source;
     bake_rule_target target;
     bake_rule_action_cb action;
+    corto_ll target_nodes; /* nodes referred to by target pattern ($NAME) */
 } bake_rule;
 
+/* A dependency rule adds dependencies to the targets of the (map) rule with the
+ * same name. The target maps each input of that rule to a dependency file. */
 typedef struct bake_dependency_rule {
     bake_node super;
     bake_rule_target target;
-    const char *deps;
+    const char *deps; /* deprecated, not used */
     bake_rule_action_cb action;
 } bake_dependency_rule;
 
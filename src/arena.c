@@ -0,0 +1,151 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+#define BAKE_ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct bake_arena_chunk {
+    struct bake_arena_chunk *next;
+    size_t size;
+    size_t used;
+    void *data[]; /* pointer type aligns allocations to pointers */
+} bake_arena_chunk;
+
+struct bake_arena_s {
+    bake_arena_chunk *chunks;
+    int users;
+};
+
+static
+bake_arena_chunk* bake_arena_chunk_new(
+    size_t size)
+{
+    bake_arena_chunk *result = corto_alloc(sizeof(bake_arena_chunk) + size);
+    result->next = NULL;
+    result->size = size;
+    result->used = 0;
+    return result;
+}
+
+bake_arena bake_arena_new(void)
+{
+    bake_arena result = corto_alloc(sizeof(struct bake_arena_s));
+    result->chunks = bake_arena_chunk_new(BAKE_ARENA_CHUNK_SIZE);
+    result->users = 0;
+    return result;
+}
+
+void bake_arena_free(
+    bake_arena arena)
+{
+    bake_arena_chunk *chunk = arena->chunks, *next;
+    while (chunk) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+void* bake_arena_alloc(
+    bake_arena arena,
+    size_t size)
+{
+    bake_arena_chunk *chunk = arena->chunks;
+
+    /* Round up to pointer alignment */
+    size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+    if (chunk->used + size > chunk->size) {
+        if (size > BAKE_ARENA_CHUNK_SIZE / 4) {
+            /* Large allocations get a dedicated chunk, which is inserted after
+             * the current chunk so that its remaining space is not lost */
+            bake_arena_chunk *large = bake_arena_chunk_new(size);
+            large->used = size;
+            large->next = chunk->next;
+            chunk->next = large;
+            return large->data;
+        }
+
+        chunk = bake_arena_chunk_new(BAKE_ARENA_CHUNK_SIZE);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    void *result = (char*)chunk->data + chunk->used;
+    chunk->used += size;
+    return result;
+}
+
+char* bake_arena_strdup(
+    bake_arena arena,
+    const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *result = bake_arena_alloc(arena, len);
+    memcpy(result, str, len);
+    return result;
+}
+
+void bake_arena_reset(
+    bake_arena arena)
+{
+    bake_arena_chunk *chunk = arena->chunks, *next;
+
+    /* Keep a single chunk of the default size */
+    bake_arena_chunk *keep = NULL;
+    while (chunk) {
+        next = chunk->next;
+        if (!keep && chunk->size == BAKE_ARENA_CHUNK_SIZE) {
+            keep = chunk;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+
+    if (!keep) {
+        keep = bake_arena_chunk_new(BAKE_ARENA_CHUNK_SIZE);
+    }
+
+    keep->next = NULL;
+    keep->used = 0;
+    arena->chunks = keep;
+}
+
+void bake_arena_keep(
+    bake_arena arena)
+{
+    corto_ainc(&arena->users);
+}
+
+void bake_arena_release(
+    bake_arena arena)
+{
+    corto_adec(&arena->users);
+}
+
+int32_t bake_arena_users(
+    bake_arena arena)
+{
+    return arena->users;
+}
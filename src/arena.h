@@ -0,0 +1,97 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section arena Arena allocator
+ * @brief Allocates small objects that share a lifetime from large chunks.
+ *
+ * Filelists allocate their files from an arena that is shared by all
+ * filelists that are created by a thread. When no filelist uses the arena
+ * anymore, its memory is reused for the next build.
+ */
+
+typedef struct bake_arena_s* bake_arena;
+
+/** Create a new arena.
+ *
+ * @return The new arena.
+ */
+bake_arena bake_arena_new(void);
+
+/** Free an arena and all memory allocated from it.
+ *
+ * @param arena The arena to free.
+ */
+void bake_arena_free(
+    bake_arena arena);
+
+/** Allocate memory from arena.
+ * Memory is aligned to a pointer and remains valid until the arena is reset
+ * or freed.
+ *
+ * @param arena The arena to allocate from.
+ * @param size The number of bytes to allocate.
+ * @return Pointer to the allocated memory.
+ */
+void* bake_arena_alloc(
+    bake_arena arena,
+    size_t size);
+
+/** Copy a string into arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param str The string to copy.
+ * @return The copied string.
+ */
+char* bake_arena_strdup(
+    bake_arena arena,
+    const char *str);
+
+/** Release all memory allocated from arena, keep the first chunk for reuse.
+ *
+ * @param arena The arena to reset.
+ */
+void bake_arena_reset(
+    bake_arena arena);
+
+/** Register a user of the arena.
+ *
+ * @param arena The arena.
+ */
+void bake_arena_keep(
+    bake_arena arena);
+
+/** Unregister a user of the arena.
+ * This does not free the arena when there are no users left. The thread that
+ * owns the arena resets it when it is no longer used.
+ *
+ * @param arena The arena.
+ */
+void bake_arena_release(
+    bake_arena arena);
+
+/** Get number of users of the arena.
+ *
+ * @param arena The arena.
+ * @return The number of users.
+ */
+int32_t bake_arena_users(
+    bake_arena arena);
@@ -37,6 +37,10 @@ static bool showProc = false;
 static bool mute_foreach = true;
 static bool profile = false;
 static bool local = false;
+static char *jobs = NULL;
+static bool use_cache = false;
+static bool use_daemon = false;
+static char *changed_since = NULL;
 static char *action = "build";
 static char *env = "default";
 static char *cfg = "debug";
@@ -50,6 +54,9 @@ static corto_ll paths = NULL;
 corto_tls BAKE_LANGUAGE_KEY;
 corto_tls BAKE_FILELIST_KEY;
 corto_tls BAKE_PROJECT_KEY;
+corto_tls BAKE_JOB_ERROR_KEY;
+corto_tls BAKE_ARENA_KEY;
+struct corto_mutex_s BAKE_LANGUAGE_LOCK;
 
 static
 int parseArgs(int argc, char *argv[])
@@ -76,6 +83,11 @@ int parseArgs(int argc, char *argv[])
             PARSE_OPTION(0, "do", foreach_cmd = argv[i + 1]; i++);
             PARSE_OPTION(0, "env", env = argv[i + 1]; i++);
             PARSE_OPTION(0, "cfg", cfg = argv[i + 1]; i++);
+            PARSE_OPTION('j', "jobs", jobs = argv[i + 1]; i++);
+            PARSE_OPTION(0, "cache", use_cache = true);
+            PARSE_OPTION(0, "server", action = "daemon");
+            PARSE_OPTION(0, "daemon", use_daemon = true);
+            PARSE_OPTION(0, "changed-since", changed_since = argv[i + 1]; i++);
 
             PARSE_OPTION(0, "debug", corto_log_verbositySet(CORTO_DEBUG));
             PARSE_OPTION(0, "trace", corto_log_verbositySet(CORTO_TRACE));
@@ -131,25 +143,33 @@ int16_t bake_check_dependencies(
     bake_project *p,
     char *artefact)
 {
-    time_t artefact_modified = 0;
-    time_t project_modified = 0;
-
-    if (corto_file_test("project.json")) {
-        project_modified = corto_lastmodified("project.json");
+    char *artefact_full = NULL;
+    char *project_json = bake_project_file(p, "project.json");
+    uint64_t project_modified = bake_mtime(project_json);
+    free(project_json);
+
+    if (!p->db) {
+        if (!(p->db = bake_db_load(p))) {
+            corto_throw("failed to load build database for '%s'", p->id);
+            goto error;
+        }
     }
 
-    char *artefact_full = corto_asprintf("bin/%s-%s/%s",
-        CORTO_PLATFORM_STRING, p->cfg->id, artefact);
-    if  (corto_file_test(artefact_full)) {
-        artefact_modified = corto_lastmodified(artefact_full);
-    }
-    free(artefact_full);
+    artefact_full = corto_asprintf("%s/bin/%s-%s/%s",
+        p->path, CORTO_PLATFORM_STRING, p->cfg->id, artefact);
+    uint64_t artefact_modified = bake_mtime(artefact_full);
+
+    /* Recomputed from the packages the project uses below */
+    p->use_hash = 0;
 
+    /* Targets record a signature of the project configuration with which they
+     * were built, so only targets affected by the change are rebuilt. Targets
+     * without a record can't be checked, so then start from a clean slate. */
     if (artefact_modified < project_modified) {
         if (artefact_modified) {
             corto_ok("cfg 'project.json' #[green](changed)#[normal]");
         }
-        if (p->managed || artefact_modified) {
+        if ((p->managed || artefact_modified) && !bake_db_has_outputs(p->db)) {
             p->sources_outdated = true;
         }
     }
@@ -221,9 +241,30 @@ int16_t bake_check_dependencies(
                 goto error;
             }
 
-            time_t dep_modified = corto_lastmodified(lib);
+            /* Compare the contents of the dependency with the contents it had
+             * when the artefact was built, so that the result does not depend
+             * on clocks of the OS and filesystem being in sync. Records are
+             * written when the artefact has been built. The contents are also
+             * part of the signature of the rule that links the artefact. A
+             * dependency that can't be read counts as changed. */
+            char *output = corto_asprintf("use:%s", package);
+            uint64_t dep_hash = bake_project_dependency_hash(p, package);
+            uint64_t recorded_hash;
+            bool changed;
+            if (!dep_hash) {
+                changed = true;
+            } else if (bake_db_output_get(p->db, output, &recorded_hash, NULL)) {
+                changed = !recorded_hash || recorded_hash != dep_hash;
+            } else {
+                /* No record yet, use timestamps */
+                changed = bake_mtime(lib) > artefact_modified;
+            }
+            free(output);
+
+            p->use_hash = bake_db_hash(p->use_hash, package, strlen(package) + 1);
+            p->use_hash = bake_db_hash(p->use_hash, &dep_hash, sizeof(dep_hash));
 
-            if (!artefact_modified || dep_modified <= artefact_modified) {
+            if (!artefact_modified || !changed) {
                 corto_ok("use '%s' => '%s'",
                     package,
                     lib);
@@ -248,13 +289,15 @@ int16_t bake_check_dependencies(
             goto error;
         }
     } else if (p->artefact_outdated) {
-        if (corto_rm(artefact)) {
+        if (corto_rm(artefact_full)) {
             goto error;
         }
     }
 
+    free(artefact_full);
     return 0;
 error:
+    if (artefact_full) free(artefact_full);
     return -1;
 }
 
@@ -280,13 +323,15 @@ int bake_action_build(bake_crawler c, bake_project* p, void *ctx) {
             goto error;
         }
     } else {
-        if (corto_file_test("src")) {
+        if (corto_file_test(strarg("%s/src", p->path))) {
             corto_warning("found 'src' directory but no language configured. add language to 'project.json'");
         }
     }
 
-    /* Step 1: clean package hierarchy */
-    if (!skip_uninstall && p->public) {
+    /* Step 1: clean package hierarchy. When files are preinstalled, files that
+     * are no longer part of the project are removed by step 2 instead, which
+     * leaves files that did not change alone. */
+    if (!skip_uninstall && skip_preinstall && p->public) {
         if (bake_uninstall(p)) {
             goto error;
         }
@@ -400,10 +445,12 @@ static
 int bake_action_foreach(bake_crawler c, bake_project* p, void *ctx) {
     if (foreach_cmd) {
         int8_t ret = 0;
-        corto_setenv("BAKE_PROJECT_ID", p->id);
-        char *cmd = corto_envparse("%s", foreach_cmd);
-        int result = corto_proc_cmd(cmd, &ret);
-        free(cmd);
+
+        /* Pass project id to command environment, which is expanded by the
+         * shell that runs the command in the project directory */
+        char *env[] = {corto_asprintf("BAKE_PROJECT_ID=%s", p->id), NULL};
+        int result = bake_exec(p->path, foreach_cmd, env, &ret);
+        free(env[0]);
         return !result && !ret;
     } else {
         return 1;
@@ -568,6 +615,271 @@ error:
     return -1;
 }
 
+/* Find projects in paths specified on the command line */
+static
+int16_t bake_crawl(
+    bake_crawler c)
+{
+    if (id) {
+        if (bake_project_fromArguments(c)) {
+            goto error;
+        }
+    } else {
+        /* Crawl specified directories (default is current) */
+        corto_iter it = corto_ll_iter(paths);
+        while (corto_iter_hasNext(&it)) {
+            char *path = corto_iter_next(&it);
+            if (bake_crawler_search(c, path)) {
+                goto error;
+            }
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Replace crawler with a crawler that searches the paths again */
+static
+int16_t bake_recrawl(
+    bake_crawler *c)
+{
+    corto_ok("projects changed, searching for projects");
+    bake_crawler_free(*c);
+    *c = bake_crawler_new(&config);
+    return bake_crawl(*c);
+}
+
+/* Drop build database that was written by another bake process since it was
+ * loaded, so that it is loaded again when the project is built */
+static
+int bake_daemon_reload_db(bake_crawler c, bake_project* p, void *ctx) {
+    if (p->db && bake_db_stale(p->db)) {
+        corto_trace("build database of '%s' changed, reloading", p->id);
+        bake_db_free(p->db);
+        p->db = NULL;
+    }
+    return 1;
+}
+
+/* Settings that determine how projects are built. Clients of a daemon must
+ * use the same settings as the daemon. */
+static
+char* bake_daemon_settings(void)
+{
+    return corto_asprintf("env=%s cfg=%s jobs=%u cache=%s",
+        config.environment, config.id, config.jobs,
+        config.cache ? config.cache : "off");
+}
+
+/* Handle request sent to daemon. Projects are only crawled again when
+ * directories or project files changed since the last request. */
+static
+int16_t bake_daemon_action(
+    const char *action,
+    void *ctx)
+{
+    bake_crawler *c = ctx;
+
+    if (bake_crawler_changed(*c)) {
+        if (bake_recrawl(c)) {
+            goto error;
+        }
+    } else {
+        bake_crawler_reset(*c);
+        bake_crawler_forEach(*c, bake_daemon_reload_db, NULL);
+    }
+
+    if (bake_do_action(*c, action)) {
+        goto error;
+    }
+
+    corto_info("done!");
+
+    return 0;
+error:
+    return -1;
+}
+
+static
+int bake_watch_project(bake_crawler c, bake_project* p, void *ctx) {
+    return !bake_watch_add(ctx, p);
+}
+
+static
+void bake_watch_clear(
+    corto_ll changed)
+{
+    corto_iter it = corto_ll_iter(changed);
+    while (corto_iter_hasNext(&it)) {
+        free(corto_iter_next(&it));
+    }
+    corto_ll_clear(changed);
+}
+
+/* Watch all projects of crawler */
+static
+bake_watch bake_watch_crawler(
+    bake_crawler c)
+{
+    bake_watch w = bake_watch_new();
+    if (!w) {
+        goto error;
+    }
+    if (bake_crawler_forEach(c, bake_watch_project, w)) {
+        bake_watch_free(w);
+        goto error;
+    }
+    return w;
+error:
+    return NULL;
+}
+
+/* Build projects, then rebuild projects (and their dependents) when their
+ * sources, includes or configuration change. Runs until interrupted. Watches
+ * are created before building, so that changes made during a build are not
+ * missed. */
+static
+int16_t bake_watch_projects(
+    bake_crawler *c)
+{
+    corto_ll changed = corto_ll_new();
+    bool config_changed = false;
+    bake_watch w = bake_watch_crawler(*c);
+    if (!w) {
+        goto error;
+    }
+
+    /* Keep watching when a build fails, so the error can be fixed */
+    if (bake_do_action(*c, "build")) {
+        corto_raise();
+    }
+
+    if (bake_watch_pending(w, changed, &config_changed)) {
+        goto error;
+    }
+
+    for (;;) {
+        /* Only wait if nothing changed while building */
+        if (!corto_ll_count(changed)) {
+            corto_ok("watching for changes");
+            if (bake_watch_wait(w, changed, &config_changed)) {
+                goto error;
+            }
+        }
+
+        /* Projects may have been added or removed, so crawl again */
+        if (config_changed) {
+            bake_watch_free(w);
+            w = NULL;
+            if (bake_recrawl(c)) {
+                goto error;
+            }
+            if (!(w = bake_watch_crawler(*c))) {
+                goto error;
+            }
+        } else {
+            bake_crawler_reset(*c);
+        }
+
+        bake_crawler_select(*c, changed);
+        if (bake_do_action(*c, "build")) {
+            corto_raise();
+        }
+
+        bake_watch_clear(changed);
+        config_changed = false;
+
+        /* Changes made while building, except those made by the build itself,
+         * are built next */
+        if (bake_watch_pending(w, changed, &config_changed)) {
+            goto error;
+        }
+    }
+
+    return 0;
+error:
+    if (w) bake_watch_free(w);
+    bake_watch_clear(changed);
+    corto_ll_free(changed);
+    return -1;
+}
+
+static
+int bake_fingerprint_changed(bake_crawler c, bake_project* p, void *ctx) {
+    void **args = ctx;
+    if (bake_fingerprints_changed(args[0], p)) {
+        corto_ll_append(args[1], p->path);
+    }
+    return 1;
+}
+
+static
+int bake_fingerprint_update(bake_crawler c, bake_project* p, void *ctx) {
+    /* Record fingerprint after building, as a build may generate sources */
+    if (!p->excluded) {
+        bake_fingerprints_store(ctx, p);
+    }
+    return 1;
+}
+
+static
+int bake_fingerprint_forget(bake_crawler c, bake_project* p, void *ctx) {
+    if (!p->excluded) {
+        bake_fingerprints_forget(ctx, p);
+    }
+    return 1;
+}
+
+/* Only walk projects that changed since the fingerprints in the state file were
+ * stored, and the projects that depend on them. Fingerprints are only stored
+ * after a successful build, and are removed when artefacts are cleaned. */
+static
+int16_t bake_do_changed(
+    bake_crawler c,
+    const char *action,
+    const char *file)
+{
+    bake_fingerprints fp = bake_fingerprints_load(file);
+    if (!fp) {
+        goto error;
+    }
+
+    corto_ll changed = corto_ll_new();
+    void *args[] = {fp, changed};
+    bake_crawler_forEach(c, bake_fingerprint_changed, args);
+    corto_ok("%d projects changed since '%s'", corto_ll_count(changed), file);
+    bake_crawler_select(c, changed);
+    corto_ll_free(changed);
+
+    if (bake_do_action(c, action)) {
+        goto error;
+    }
+
+    if (!strcmp(action, "build") || !strcmp(action, "rebake") ||
+        !strcmp(action, "rebuild"))
+    {
+        bake_crawler_forEach(c, bake_fingerprint_update, fp);
+    } else if (!strcmp(action, "clean") || !strcmp(action, "uninstall")) {
+        bake_crawler_forEach(c, bake_fingerprint_forget, fp);
+    } else {
+        /* Action did not change what is built */
+        bake_fingerprints_free(fp);
+        return 0;
+    }
+
+    if (bake_fingerprints_save(fp)) {
+        goto error;
+    }
+
+    bake_fingerprints_free(fp);
+    return 0;
+error:
+    if (fp) bake_fingerprints_free(fp);
+    return -1;
+}
+
 static
 int16_t bake_init(int argc, char* argv[])
 {
@@ -589,6 +901,26 @@ int16_t bake_init(int argc, char* argv[])
         goto error;
     }
 
+    /* Initialize thread key for error state of parallel jobs */
+    if (corto_tls_new(&BAKE_JOB_ERROR_KEY, NULL)) {
+        goto error;
+    }
+
+    /* Initialize thread key for memory of filelists */
+    if (corto_tls_new(&BAKE_ARENA_KEY, (void(*)(void*))bake_arena_free)) {
+        goto error;
+    }
+
+    /* Initialize lock for loading languages from parallel builds */
+    if (corto_mutex_new(&BAKE_LANGUAGE_LOCK)) {
+        goto error;
+    }
+
+    /* Initialize cache for compiled patterns */
+    if (bake_matcher_init()) {
+        goto error;
+    }
+
     if (corto_getenv("BAKE_CONFIG")) {
         cfg = corto_getenv("BAKE_CONFIG");
     }
@@ -657,6 +989,26 @@ int main(int argc, char* argv[]) {
         goto error;
     }
 
+    uint32_t job_count = 0;
+    if (jobs) {
+        int n = atoi(jobs);
+        if (n < 1) {
+            corto_throw("invalid value for --jobs, expected a number larger than 0");
+            goto error;
+        }
+        job_count = n;
+    }
+
+    /* Projects and files built in parallel share the same job slots, which
+     * are also shared with (parent) make processes through MAKEFLAGS */
+    config.jobs = bake_jobserver_init(job_count);
+
+    /* Object cache is enabled with --cache, or by setting BAKE_CACHE */
+    if (use_cache || corto_getenv("BAKE_CACHE")) {
+        config.cache = bake_cache_path();
+        corto_trace("using object cache in '%s'", config.cache);
+    }
+
     bake_crawler c = bake_crawler_new(&config);
 
     /* Verify environment variables */
@@ -693,7 +1045,10 @@ int main(int argc, char* argv[]) {
                 strcmp(action, "rebake") &&
                 strcmp(action, "rebuild") &&
                 strcmp(action, "install") &&
-                strcmp(action, "foreach"))
+                strcmp(action, "foreach") &&
+                strcmp(action, "daemon") &&
+                strcmp(action, "watch") &&
+                !use_daemon)
             {
                 corto_ll_append(paths, action);
                 action = "build";
@@ -745,19 +1100,21 @@ int main(int argc, char* argv[]) {
     }
     corto_log_pop();
 
-    if (id) {
-        if (bake_project_fromArguments(c)) {
+    /* Let daemon that serves the same paths run the action */
+    if (use_daemon) {
+        char *socket_path = bake_daemon_socket(paths);
+        char *settings = bake_daemon_settings();
+        int16_t ret = bake_daemon_request(socket_path, settings, action);
+        free(settings);
+        free(socket_path);
+        if (ret) {
             goto error;
         }
-    } else {
-        /* Crawl specified directories (default is current) */
-        corto_iter it = corto_ll_iter(paths);
-        while (corto_iter_hasNext(&it)) {
-            char *path = corto_iter_next(&it);
-            if (bake_crawler_search(c, path)) {
-                goto error;
-            }
-        }
+        goto done;
+    }
+
+    if (bake_crawl(c)) {
+        goto error;
     }
 
     if (!bake_crawler_count(c)) {
@@ -771,25 +1128,55 @@ int main(int argc, char* argv[]) {
         root_bake = true;
     }
 
-    if (bake_do_action(c, action)) {
-        corto_throw(NULL);
-        goto error;
-    }
+    if (!strcmp(action, "daemon")) {
+        /* Keep projects and languages loaded, and serve build requests */
+        char *socket_path = bake_daemon_socket(paths);
+        char *settings = bake_daemon_settings();
+        int16_t ret = bake_daemon_run(
+            socket_path, settings, bake_daemon_action, &c);
+        free(settings);
+        free(socket_path);
+        if (ret) {
+            goto error;
+        }
+    } else if (!strcmp(action, "watch")) {
+        if (bake_watch_projects(&c)) {
+            goto error;
+        }
+    } else {
+        int16_t ret;
+        if (changed_since) {
+            ret = bake_do_changed(c, action, changed_since);
+        } else {
+            ret = bake_do_action(c, action);
+        }
+
+        if (ret) {
+            corto_throw(NULL);
+            goto error;
+        }
 
-    if (root_bake) {
-        corto_info("done!");
+        if (root_bake) {
+            corto_info("done!");
+        }
     }
 
+done:
     /* Cleanup resources */
     bake_crawler_free(c);
+    bake_jobserver_deinit();
+    bake_matcher_deinit();
     platform_deinit();
 
     if (path_tokens) free(path_tokens);
     if (paths) corto_ll_free(paths);
     if (path_string) free(path_string);
+    if (config.cache) free(config.cache);
 
     return 0;
 error:
+    bake_jobserver_deinit();
+    bake_matcher_deinit();
     platform_deinit();
     return -1;
 }
@@ -33,6 +33,18 @@
 #include "install.h"
 #include "language.h"
 #include "config.h"
+#include "exec.h"
+#include "jobs.h"
+#include "db.h"
+#include "depfile.h"
+#include "cache.h"
+#include "arena.h"
+#include "dircache.h"
+#include "mtime.h"
+#include "matcher.h"
+#include "daemon.h"
+#include "watch.h"
+#include "fingerprint.h"
 
 int16_t bake_setup(const char *exec, bool local);
 int16_t bake_setup_globalScript(void);
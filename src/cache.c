@@ -0,0 +1,297 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+#include <inttypes.h>
+#include <utime.h>
+
+/* Maximum number of input sets per manifest */
+#define BAKE_CACHE_MANIFEST_MAX (8)
+
+/* Used to create unique temporary file names */
+static int bake_cache_tmp_count = 0;
+
+char* bake_cache_path(void)
+{
+    char *cache = corto_getenv("BAKE_CACHE");
+    if (cache && cache[0]) {
+        return corto_strdup(cache);
+    } else {
+        return corto_envparse("$HOME/.bake/cache");
+    }
+}
+
+/* Entries are grouped in directories by the first byte of the key, to keep
+ * directories small. */
+static
+char* bake_cache_file(
+    const char *cache,
+    uint64_t key,
+    const char *kind)
+{
+    return corto_asprintf("%s/%02x/%016" PRIx64 ".%s",
+        cache, (unsigned)(key >> 56), key, kind);
+}
+
+/* Write file atomically, so concurrent builds never see partial entries */
+static
+int16_t bake_cache_copy(
+    const char *src,
+    const char *dst)
+{
+    char *tmp = corto_asprintf("%s.%d.%d.tmp",
+        dst, (int)getpid(), corto_ainc(&bake_cache_tmp_count));
+
+    if (corto_cp(src, tmp)) {
+        goto error;
+    }
+
+    if (rename(tmp, dst)) {
+        corto_throw("failed to move '%s' to '%s': %s", tmp, dst, strerror(errno));
+        unlink(tmp);
+        goto error;
+    }
+
+    free(tmp);
+    return 0;
+error:
+    free(tmp);
+    return -1;
+}
+
+int16_t bake_cache_fetch(
+    const char *cache,
+    uint64_t key,
+    const char *kind,
+    const char *dst,
+    bool link_file)
+{
+    char *file = bake_cache_file(cache, key, kind);
+    int16_t result = 1;
+
+    if (corto_file_test(file) == 1) {
+        unlink(dst);
+        if (!link_file || link(file, dst)) {
+            /* Cache may be on a different filesystem */
+            if (bake_cache_copy(file, dst)) {
+                corto_throw(NULL);
+                result = -1;
+                goto done;
+            }
+        }
+
+        /* Outputs that depend on the retrieved file compare timestamps */
+        utime(dst, NULL);
+        result = 0;
+    }
+
+done:
+    free(file);
+    return result;
+}
+
+int16_t bake_cache_store(
+    const char *cache,
+    uint64_t key,
+    const char *kind,
+    const char *src)
+{
+    char *file = bake_cache_file(cache, key, kind);
+    char *dir = corto_strdup(file);
+    *strrchr(dir, '/') = '\0';
+
+    if (corto_mkdir(dir)) {
+        corto_throw(NULL);
+        goto error;
+    }
+
+    if (bake_cache_copy(src, file)) {
+        corto_throw(NULL);
+        goto error;
+    }
+
+    free(dir);
+    free(file);
+    return 0;
+error:
+    free(dir);
+    free(file);
+    return -1;
+}
+
+corto_ll bake_cache_manifest_load(
+    const char *cache,
+    uint64_t key)
+{
+    char *file = bake_cache_file(cache, key, "m");
+    char *content = corto_file_load(file);
+    free(file);
+
+    if (!content) {
+        return NULL;
+    }
+
+    /* Sets of files are separated by a line that contains a single '-' */
+    corto_ll manifest = corto_ll_new();
+    corto_ll files = corto_ll_new();
+    char *line = content, *next;
+    for (; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next) {
+            *next = '\0';
+            next ++;
+        }
+
+        if (!strcmp(line, "-")) {
+            corto_ll_append(manifest, files);
+            files = corto_ll_new();
+        } else if (line[0]) {
+            corto_ll_append(files, corto_strdup(line));
+        }
+    }
+
+    if (corto_ll_count(files)) {
+        corto_ll_append(manifest, files);
+    } else {
+        corto_ll_free(files);
+    }
+
+    free(content);
+
+    return manifest;
+}
+
+static
+bool bake_cache_files_equal(
+    corto_ll files1,
+    corto_ll files2)
+{
+    uint32_t count1 = files1 ? corto_ll_count(files1) : 0;
+    uint32_t count2 = files2 ? corto_ll_count(files2) : 0;
+
+    if (count1 != count2) {
+        return false;
+    } else if (!count1) {
+        return true;
+    }
+
+    corto_iter it1 = corto_ll_iter(files1);
+    corto_iter it2 = corto_ll_iter(files2);
+    while (corto_iter_hasNext(&it1)) {
+        if (strcmp(corto_iter_next(&it1), corto_iter_next(&it2))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int16_t bake_cache_manifest_add(
+    const char *cache,
+    uint64_t key,
+    corto_ll files)
+{
+    corto_ll manifest = bake_cache_manifest_load(cache, key);
+    corto_buffer buf = CORTO_BUFFER_INIT;
+    char *file = bake_cache_file(cache, key, "m");
+    char *tmp = NULL;
+    int16_t result = -1;
+    FILE *f = NULL;
+
+    /* Most recently used set goes first, as it is most likely to match */
+    corto_buffer_appendstr(&buf, "");
+    if (files) {
+        corto_iter it = corto_ll_iter(files);
+        while (corto_iter_hasNext(&it)) {
+            corto_buffer_append(&buf, "%s\n", (char*)corto_iter_next(&it));
+        }
+    }
+    corto_buffer_appendstr(&buf, "-\n");
+
+    if (manifest) {
+        uint32_t count = 1;
+        corto_iter it = corto_ll_iter(manifest);
+        while (corto_iter_hasNext(&it) && count < BAKE_CACHE_MANIFEST_MAX) {
+            corto_ll set = corto_iter_next(&it);
+            if (bake_cache_files_equal(set, files)) {
+                continue;
+            }
+
+            corto_iter set_it = corto_ll_iter(set);
+            while (corto_iter_hasNext(&set_it)) {
+                corto_buffer_append(&buf, "%s\n", (char*)corto_iter_next(&set_it));
+            }
+            corto_buffer_appendstr(&buf, "-\n");
+            count ++;
+        }
+        bake_cache_manifest_free(manifest);
+    }
+
+    char *str = corto_buffer_str(&buf);
+
+    char *dir = corto_strdup(file);
+    *strrchr(dir, '/') = '\0';
+    if (corto_mkdir(dir)) {
+        free(dir);
+        corto_throw(NULL);
+        goto done;
+    }
+    free(dir);
+
+    tmp = corto_asprintf("%s.%d.%d.tmp",
+        file, (int)getpid(), corto_ainc(&bake_cache_tmp_count));
+    if (!(f = fopen(tmp, "w"))) {
+        corto_throw("failed to open '%s': %s", tmp, strerror(errno));
+        goto done;
+    }
+
+    bool written = fputs(str, f) >= 0;
+    if (fclose(f) || !written) {
+        corto_throw("failed to write '%s': %s", tmp, strerror(errno));
+        unlink(tmp);
+        goto done;
+    }
+
+    if (rename(tmp, file)) {
+        corto_throw("failed to move '%s' to '%s': %s", tmp, file, strerror(errno));
+        unlink(tmp);
+        goto done;
+    }
+
+    result = 0;
+done:
+    if (tmp) free(tmp);
+    if (str) free(str);
+    free(file);
+    return result;
+}
+
+void bake_cache_manifest_free(
+    corto_ll manifest)
+{
+    if (manifest) {
+        corto_iter it = corto_ll_iter(manifest);
+        while (corto_iter_hasNext(&it)) {
+            bake_depfile_free(corto_iter_next(&it));
+        }
+        corto_ll_free(manifest);
+    }
+}
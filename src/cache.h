@@ -0,0 +1,102 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section cache Object cache API
+ * @brief Content addressed store of build outputs, shared between checkouts
+ *        and builds of a project.
+ *
+ * Outputs are stored by a key that is computed from the contents of all inputs
+ * and the signature of the action that built them. The signature includes the
+ * project id, as language bindings may use it in commands, so outputs are not
+ * shared between different projects. Since the inputs that were
+ * used (like included headers) are only known after an action ran, the cache
+ * keeps manifests. A manifest is stored by the hash of the primary input and
+ * action signature, and lists sets of additional inputs with which the output
+ * has been built before.
+ */
+
+/** Get location of object cache.
+ * This is the value of BAKE_CACHE if set, or ~/.bake/cache otherwise.
+ *
+ * @return Path to the cache directory (must be freed).
+ */
+char* bake_cache_path(void);
+
+/** Retrieve an output from the cache.
+ *
+ * @param cache Path to the cache directory.
+ * @param key Key of the output.
+ * @param kind Kind of output (file extension in the cache).
+ * @param dst Path to which to retrieve the output.
+ * @param link Hardlink to the cache if possible, copy otherwise.
+ * @return 0 if retrieved, 1 if not in the cache, -1 if failed.
+ */
+int16_t bake_cache_fetch(
+    const char *cache,
+    uint64_t key,
+    const char *kind,
+    const char *dst,
+    bool link);
+
+/** Add an output to the cache.
+ *
+ * @param cache Path to the cache directory.
+ * @param key Key of the output.
+ * @param kind Kind of output (file extension in the cache).
+ * @param src Path to the file to store.
+ * @return 0 if success, -1 if failed.
+ */
+int16_t bake_cache_store(
+    const char *cache,
+    uint64_t key,
+    const char *kind,
+    const char *src);
+
+/** Load a manifest.
+ *
+ * @param cache Path to the cache directory.
+ * @param key Key of the manifest.
+ * @return List of lists of files, or NULL if there is no manifest.
+ */
+corto_ll bake_cache_manifest_load(
+    const char *cache,
+    uint64_t key);
+
+/** Add a set of files to a manifest.
+ * If the manifest already contains the set, it is moved to the front.
+ *
+ * @param cache Path to the cache directory.
+ * @param key Key of the manifest.
+ * @param files List of files (strings).
+ * @return 0 if success, -1 if failed.
+ */
+int16_t bake_cache_manifest_add(
+    const char *cache,
+    uint64_t key,
+    corto_ll files);
+
+/** Free a manifest returned by bake_cache_manifest_load.
+ *
+ * @param manifest The manifest.
+ */
+void bake_cache_manifest_free(
+    corto_ll manifest);
@@ -26,8 +26,29 @@ struct bake_crawler_s {
     corto_ll leafs; /* projects that cannot act as dependencies */
     uint32_t count;
     bake_config *cfg;
+    corto_ll crawled; /* crawled directories and project files */
 };
 
+/* File or directory inspected by crawler, used to detect changes */
+typedef struct bake_crawler_file {
+    char *path;
+    uint64_t timestamp;
+} bake_crawler_file;
+
+/* State shared between workers that walk the project graph */
+typedef struct bake_crawler_walker {
+    bake_crawler crawler;
+    const char *action_name;
+    bake_crawler_cb action;
+    void *ctx;
+    corto_ll readyForBuild; /* projects with no unresolved dependencies */
+    uint32_t built; /* number of projects built */
+    uint32_t active; /* number of projects being built */
+    bool failed; /* set by first failing project, stops the walk */
+    struct corto_mutex_s lock;
+    struct corto_cond_s cond;
+} bake_crawler_walker;
+
 static
 int project_cmp(void *ctx, const void* key1, const void* key2) {
     return strcmp(key1, key2);
@@ -125,13 +146,26 @@ error:
     return NULL;
 }
 
+/* Record timestamp of crawled file. If it changes, the result of crawling
+ * may be different. */
+static
+void bake_crawler_record(
+    bake_crawler _this,
+    const char *path)
+{
+    bake_crawler_file *f = corto_alloc(sizeof(bake_crawler_file));
+    f->path = corto_strdup(path);
+    f->timestamp = bake_mtime(path);
+    if (!_this->crawled) _this->crawled = corto_ll_new();
+    corto_ll_append(_this->crawled, f);
+}
+
 static
 int16_t bake_crawler_crawl(
     bake_crawler _this,
     const char *wd,
     const char *path)
 {
-    char *prev = strdup(corto_cwd());
     char *fullpath;
     if (path[0] != '/') {
         fullpath = corto_asprintf("%s/%s", wd, path);
@@ -143,23 +177,22 @@ int16_t bake_crawler_crawl(
     bool isProject = false;
     bake_project *p = NULL;
 
-    if (corto_chdir(path)) {
-        goto error;
-    }
+    bake_crawler_record(_this, fullpath);
 
-    if (corto_file_test("project.json")) {
+    if (corto_file_test(strarg("%s/project.json", fullpath))) {
         isProject = true;
+        bake_crawler_record(_this, strarg("%s/project.json", fullpath));
         if (!(p = bake_crawler_addProject(_this, fullpath))) {
             goto error;
         }
 
-        if (corto_file_test("rakefile")) {
+        if (corto_file_test(strarg("%s/rakefile", fullpath))) {
             corto_warning(
                 "path '%s' contains redundant rakefile",
                 fullpath);
         }
     } else {
-        if (corto_file_test("rakefile")) {
+        if (corto_file_test(strarg("%s/rakefile", fullpath))) {
             corto_warning(
                 "path '%s' contains rake-based project, skipping",
                 fullpath);
@@ -168,7 +201,7 @@ int16_t bake_crawler_crawl(
     }
 
     corto_iter it;
-    if (corto_dir_iter(".", NULL, &it)) {
+    if (corto_dir_iter(fullpath, NULL, &it)) {
         corto_throw("failed to open directory '%s'", fullpath);
         goto error;
     }
@@ -176,7 +209,7 @@ int16_t bake_crawler_crawl(
     while (corto_iter_hasNext(&it)) {
         char *file = corto_iter_next(&it);
 
-        if (corto_isdir(file)) {
+        if (corto_isdir(strarg("%s/%s", fullpath, file))) {
             corto_trace("looking for projects in '%s'", file);
 
             /* If this is a corto project, filter out directories that have
@@ -215,14 +248,10 @@ int16_t bake_crawler_crawl(
     }
 
 skip:
-    if (corto_chdir(prev)) {
-        corto_throw("failed to restore directory to '%s'", prev);
-        goto error;
-    }
-
+    free(fullpath);
     return 0;
 error:
-    if (prev) free(prev);
+    free(fullpath);
     return -1;
 }
 
@@ -252,9 +281,93 @@ void bake_crawler_free(bake_crawler _this)
         }
         corto_ll_free(_this->leafs);
     }
+    if (_this->crawled) {
+        corto_iter it = corto_ll_iter(_this->crawled);
+        while (corto_iter_hasNext(&it)) {
+            bake_crawler_file *f = corto_iter_next(&it);
+            free(f->path);
+            free(f);
+        }
+        corto_ll_free(_this->crawled);
+    }
     free (_this);
 }
 
+bool bake_crawler_changed(
+    bake_crawler _this)
+{
+    if (_this->crawled) {
+        corto_iter it = corto_ll_iter(_this->crawled);
+        while (corto_iter_hasNext(&it)) {
+            bake_crawler_file *f = corto_iter_next(&it);
+            if (bake_mtime(f->path) != f->timestamp) {
+                corto_trace("'%s' changed", f->path);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static
+void bake_crawler_reset_projects(
+    corto_iter *it)
+{
+    while (corto_iter_hasNext(it)) {
+        bake_project *p = corto_iter_next(it);
+        p->error = false;
+        p->freshly_baked = false;
+        p->changed = false;
+        p->artefact_outdated = false;
+        p->sources_outdated = false;
+        p->built = false;
+        p->excluded = false;
+        p->unresolved_dependencies = 0;
+    }
+}
+
+static
+void bake_crawler_reset_dependencies(
+    corto_iter *it)
+{
+    while (corto_iter_hasNext(it)) {
+        bake_project *p = corto_iter_next(it);
+        if (p->dependents) {
+            corto_iter dep_it = corto_ll_iter(p->dependents);
+            while (corto_iter_hasNext(&dep_it)) {
+                bake_project *dependent = corto_iter_next(&dep_it);
+                dependent->unresolved_dependencies ++;
+            }
+        }
+    }
+}
+
+void bake_crawler_reset(
+    bake_crawler _this)
+{
+    corto_iter it;
+
+    if (_this->nodes) {
+        it = corto_rb_iter(_this->nodes);
+        bake_crawler_reset_projects(&it);
+    }
+    if (_this->leafs) {
+        it = corto_ll_iter(_this->leafs);
+        bake_crawler_reset_projects(&it);
+    }
+
+    /* Restore dependency counts from the project graph, as walking the graph
+     * decreases them */
+    if (_this->nodes) {
+        it = corto_rb_iter(_this->nodes);
+        bake_crawler_reset_dependencies(&it);
+    }
+    if (_this->leafs) {
+        it = corto_ll_iter(_this->leafs);
+        bake_crawler_reset_dependencies(&it);
+    }
+}
+
 uint32_t bake_crawler_count(
     bake_crawler _this)
 {
@@ -270,7 +383,9 @@ int16_t bake_crawler_search(
     int count = bake_crawler_count(_this);
 
     if (corto_file_test(path)) {
-        ret = bake_crawler_crawl(_this, ".", path);
+        /* Start from absolute path, so project paths do not depend on the
+         * working directory */
+        ret = bake_crawler_crawl(_this, corto_cwd(), path);
     } else {
         corto_throw("path '%s' not found", path);
         goto error;
@@ -322,22 +437,18 @@ int16_t bake_crawler_build_project(
     const char *action_name,
     bake_crawler_cb action,
     bake_project *p,
-    void *ctx,
-    corto_ll readyForBuild)
+    void *ctx)
 {
+    if (p->excluded) {
+        return 0;
+    }
+
     corto_ok(
         "begin %s %s '%s' in '%s'",
         action_name, bake_project_kind_str(p->kind), p->id, p->path);
 
-    char *prev = strdup(corto_cwd());
-    if (corto_chdir(p->path)) {
-        free(prev);
-        goto error;
-    }
-
     if (!action(_this, p, ctx)) {
         corto_throw("build interrupted by '%s' in '%s'", p->id, p->path);
-        free(prev);
         goto error;
     }
 
@@ -350,20 +461,101 @@ int16_t bake_crawler_build_project(
             "  #[grey]up to date#[normal] '%s'",
             p->id);
     }
-    if (corto_chdir(prev)) {
-        free(prev);
-        goto error;
-    }
-    free(prev);
-
-    /* Decrease unresolved_dependencies of dependents */
-    bake_crawler_decrease_dependents(p, readyForBuild);
 
     return 0;
 error:
     return -1;
 }
 
+/* Take projects from the ready list until all projects are built, or until
+ * a project failed to build. Workers other than the main thread acquire a
+ * jobserver token for each project, so that projects and files built in
+ * parallel share the same budget. */
+static
+int16_t bake_crawler_work(
+    bake_crawler_walker *w,
+    bool use_token)
+{
+    int16_t result = 0;
+
+    corto_mutex_lock(&w->lock);
+    for (;;) {
+        bake_project *p = NULL;
+        if (!w->failed) {
+            p = corto_ll_takeFirst(w->readyForBuild);
+        }
+
+        if (!p) {
+            /* If no projects are being built, no new projects can become
+             * ready, so the walk is done. */
+            if (w->failed || !w->active) {
+                break;
+            }
+            corto_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+
+        w->active ++;
+        corto_mutex_unlock(&w->lock);
+
+        char token = 0;
+        int16_t ret = 0;
+        if (use_token) {
+            ret = bake_jobserver_acquire(&token, NULL, NULL);
+
+            /* Another project may have failed while waiting for a token */
+            if (!ret) {
+                corto_mutex_lock(&w->lock);
+                if (w->failed) {
+                    bake_jobserver_release(token);
+                    w->active --;
+                    corto_cond_broadcast(&w->cond);
+                    break;
+                }
+                corto_mutex_unlock(&w->lock);
+            }
+        }
+
+        if (!ret) {
+            ret = bake_crawler_build_project(
+                w->crawler, w->action_name, w->action, p, w->ctx);
+            if (use_token) {
+                bake_jobserver_release(token);
+            }
+        }
+
+        corto_mutex_lock(&w->lock);
+        w->active --;
+        if (ret) {
+            w->failed = true;
+            result = -1;
+        } else {
+            p->built = true;
+            w->built ++;
+
+            /* Decrease unresolved_dependencies of dependents */
+            bake_crawler_decrease_dependents(p, w->readyForBuild);
+        }
+
+        /* Wake up workers waiting for projects, or for the walk to finish */
+        corto_cond_broadcast(&w->cond);
+    }
+    corto_mutex_unlock(&w->lock);
+
+    return result;
+}
+
+static
+void* bake_crawler_worker(
+    void *arg)
+{
+    if (bake_crawler_work(arg, true)) {
+        /* Errors are stored per thread, so report before the thread exits */
+        corto_raise();
+    }
+    return NULL;
+}
+
 static
 void bake_crawler_collect_projects(
     bake_crawler _this,
@@ -384,8 +576,21 @@ int16_t bake_crawler_walk(
     bake_crawler_cb action,
     void *ctx)
 {
-    corto_ll readyForBuild = corto_ll_new();
-    uint32_t built = 0;
+    uint32_t i, jobs = _this->cfg && _this->cfg->jobs ? _this->cfg->jobs : 1;
+    corto_thread *workers = NULL;
+    bake_crawler_walker w = {
+        .crawler = _this,
+        .action_name = action_name,
+        .action = action,
+        .ctx = ctx,
+        .readyForBuild = corto_ll_new()
+    };
+
+    if (corto_mutex_new(&w.lock) || corto_cond_new(&w.cond)) {
+        corto_throw("failed to initialize project scheduler");
+        corto_ll_free(w.readyForBuild);
+        goto error;
+    }
 
     /* Decrease unresolved dependencies for placeholder projects */
     if (_this->nodes) {
@@ -401,34 +606,160 @@ int16_t bake_crawler_walk(
     /* Collect initial projects */
     if (_this->nodes) {
         corto_iter it = corto_rb_iter(_this->nodes);
-        bake_crawler_collect_projects(_this, &it, readyForBuild);
+        bake_crawler_collect_projects(_this, &it, w.readyForBuild);
     }
 
     if (_this->leafs) {
         corto_iter it = corto_ll_iter(_this->leafs);
-        bake_crawler_collect_projects(_this, &it, readyForBuild);
+        bake_crawler_collect_projects(_this, &it, w.readyForBuild);
     }
 
-    /* Walk projects (when dependencies are resolved the list will populate) */
-    bake_project *p;
-    while ((p = corto_ll_takeFirst(readyForBuild))) {
-        if (bake_crawler_build_project(_this, action_name, action, p, ctx, readyForBuild)) {
-            corto_throw(NULL);
-            goto error;
+    /* Walk projects (when dependencies are resolved the list will populate).
+     * The current thread acts as the first worker. */
+    if (jobs > 1) {
+        workers = corto_alloc(sizeof(corto_thread) * jobs);
+        for (i = 1; i < jobs; i ++) {
+            workers[i] = corto_thread_new(bake_crawler_worker, &w);
+            if (!workers[i]) {
+                /* Continue with the workers that did start */
+                corto_warning("failed to start worker thread, using %u jobs", i);
+                jobs = i;
+                break;
+            }
+        }
+    }
+
+    int16_t ret = bake_crawler_work(&w, false);
+
+    if (workers) {
+        for (i = 1; i < jobs; i ++) {
+            corto_thread_join(workers[i], NULL);
         }
-        built ++;
+        free(workers);
+    }
+
+    corto_ll_free(w.readyForBuild);
+    corto_cond_free(&w.cond);
+    corto_mutex_free(&w.lock);
+
+    if (ret) {
+        corto_throw(NULL);
+        goto error;
+    } else if (w.failed) {
+        corto_throw("build interrupted");
+        goto error;
     }
 
     /* If there are still unbuilt projects there must be a cycle in the graph */
-    if (built != _this->count) {
+    if (w.built != _this->count) {
         corto_throw("project dependency graph contains cycles (%d built vs %d total)",
-            built, _this->count);
+            w.built, _this->count);
         goto error;
     }
 
-    corto_ll_free(readyForBuild);
-
     return 1;
 error:
     return 0;
 }
+
+static
+void bake_crawler_include(
+    bake_project *p)
+{
+    if (p->excluded) {
+        p->excluded = false;
+        if (p->dependents) {
+            corto_iter it = corto_ll_iter(p->dependents);
+            while (corto_iter_hasNext(&it)) {
+                bake_crawler_include(corto_iter_next(&it));
+            }
+        }
+    }
+}
+
+static
+void bake_crawler_exclude_projects(
+    corto_iter *it)
+{
+    while (corto_iter_hasNext(it)) {
+        bake_project *p = corto_iter_next(it);
+        p->excluded = true;
+    }
+}
+
+static
+void bake_crawler_select_projects(
+    corto_iter *it,
+    corto_ll paths)
+{
+    while (corto_iter_hasNext(it)) {
+        bake_project *p = corto_iter_next(it);
+        if (!p->path) {
+            continue;
+        }
+
+        corto_iter path_it = corto_ll_iter(paths);
+        while (corto_iter_hasNext(&path_it)) {
+            if (!strcmp(p->path, corto_iter_next(&path_it))) {
+                bake_crawler_include(p);
+                break;
+            }
+        }
+    }
+}
+
+void bake_crawler_select(
+    bake_crawler _this,
+    corto_ll paths)
+{
+    corto_iter it;
+
+    if (_this->nodes) {
+        it = corto_rb_iter(_this->nodes);
+        bake_crawler_exclude_projects(&it);
+    }
+    if (_this->leafs) {
+        it = corto_ll_iter(_this->leafs);
+        bake_crawler_exclude_projects(&it);
+    }
+
+    if (_this->nodes) {
+        it = corto_rb_iter(_this->nodes);
+        bake_crawler_select_projects(&it, paths);
+    }
+    if (_this->leafs) {
+        it = corto_ll_iter(_this->leafs);
+        bake_crawler_select_projects(&it, paths);
+    }
+}
+
+int16_t bake_crawler_forEach(
+    bake_crawler _this,
+    bake_crawler_cb action,
+    void *ctx)
+{
+    corto_iter it;
+
+    if (_this->nodes) {
+        it = corto_rb_iter(_this->nodes);
+        while (corto_iter_hasNext(&it)) {
+            bake_project *p = corto_iter_next(&it);
+            if (p->path && !action(_this, p, ctx)) {
+                goto error;
+            }
+        }
+    }
+    if (_this->leafs) {
+        it = corto_ll_iter(_this->leafs);
+        while (corto_iter_hasNext(&it)) {
+            bake_project *p = corto_iter_next(&it);
+            if (!action(_this, p, ctx)) {
+                goto error;
+            }
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
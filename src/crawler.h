@@ -58,6 +58,45 @@ int16_t bake_crawler_search(
 uint32_t bake_crawler_count(
     bake_crawler _this);
 
+/** Test if directories or project files changed since they were crawled.
+ * If so, the crawler must be recreated to find new or changed projects.
+ *
+ * @param _this The crawler.
+ * @return true if crawled files changed, otherwise false.
+ */
+bool bake_crawler_changed(
+    bake_crawler _this);
+
+/** Reset build status of projects, so that the crawler can be walked again.
+ *
+ * @param _this The crawler.
+ */
+void bake_crawler_reset(
+    bake_crawler _this);
+
+/** Only run the next walk for the specified projects and their dependents.
+ * Other projects are treated as if they are up to date.
+ *
+ * @param _this The crawler.
+ * @param paths List of paths of projects to select.
+ */
+void bake_crawler_select(
+    bake_crawler _this,
+    corto_ll paths);
+
+/** Invoke callback for every project found by the crawler.
+ * Projects are not visited in dependency order.
+ *
+ * @param _this The crawler.
+ * @param action Callback to invoke. If it returns 0, iteration stops.
+ * @param ctx Context passed to callback.
+ * @return 0 if all projects were visited, -1 if iteration was stopped.
+ */
+int16_t bake_crawler_forEach(
+    bake_crawler _this,
+    bake_crawler_cb action,
+    void *ctx);
+
 /** Manually add a project to the crawler.
  *
  * @param _this A crawler object.
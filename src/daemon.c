@@ -0,0 +1,473 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+/* Required for struct ucred */
+#define _GNU_SOURCE
+#endif
+
+#include "bake.h"
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define BAKE_DAEMON_MAX_REQUEST (1024)
+
+char* bake_daemon_socket(
+    corto_ll paths)
+{
+    corto_buffer buf = CORTO_BUFFER_INIT;
+    int count = 0;
+
+    /* Daemons are identified by the absolute paths they serve */
+    corto_iter it = corto_ll_iter(paths);
+    while (corto_iter_hasNext(&it)) {
+        char *path = corto_iter_next(&it);
+        char *fullpath = path[0] == '/'
+            ? corto_strdup(path)
+            : corto_asprintf("%s/%s", corto_cwd(), path)
+            ;
+        corto_path_clean(fullpath, fullpath);
+        if (count) {
+            corto_buffer_appendstr(&buf, ",");
+        }
+        corto_buffer_appendstr(&buf, fullpath);
+        free(fullpath);
+        count ++;
+    }
+
+    char *str = corto_buffer_str(&buf);
+    uint64_t hash = bake_db_hash(0, str, str ? strlen(str) : 0);
+    free(str);
+
+    /* Socket paths are limited in length, so don't store it in the project.
+     * Sockets are stored in a directory that only the user can access, so
+     * other users cannot create a socket that clients connect to. */
+    const char *tmp = corto_getenv("TMPDIR");
+    if (!tmp || !tmp[0]) {
+        tmp = "/tmp";
+    }
+
+    return corto_asprintf("%s/bake-%u/%016llx.sock",
+        tmp, (unsigned)getuid(), (unsigned long long)hash);
+}
+
+/* Check that the directory of a socket is private to the current user. The
+ * directory is created if it does not exist and create is true. */
+static
+int16_t bake_daemon_socket_dir(
+    const char *socket_path,
+    bool create)
+{
+    char *dir = corto_strdup(socket_path);
+    char *ptr = strrchr(dir, '/');
+    if (ptr) {
+        ptr[0] = '\0';
+    }
+
+    if (create && mkdir(dir, 0700) && errno != EEXIST) {
+        corto_throw("failed to create '%s': %s", dir, strerror(errno));
+        goto error;
+    }
+
+    struct stat st;
+    if (lstat(dir, &st)) {
+        corto_throw("cannot access '%s': %s", dir, strerror(errno));
+        goto error;
+    }
+
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077)) {
+        corto_throw("'%s' must be a directory only accessible by the current user",
+            dir);
+        goto error;
+    }
+
+    free(dir);
+    return 0;
+error:
+    free(dir);
+    return -1;
+}
+
+/* Check that the process on the other end of a socket runs as the current
+ * user, as the client hands its terminal to the daemon */
+static
+bool bake_daemon_peer_trusted(
+    int fd)
+{
+#ifdef __linux__
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+        return false;
+    }
+    return cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid)) {
+        return false;
+    }
+    return uid == getuid();
+#endif
+}
+
+static
+int bake_daemon_connect(
+    const char *socket_path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        corto_throw("socket path '%s' is too long", socket_path);
+        goto error;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    if (bake_daemon_socket_dir(socket_path, false)) {
+        goto error;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        corto_throw("failed to create socket: %s", strerror(errno));
+        goto error;
+    }
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        close(fd);
+        goto error;
+    }
+
+    if (!bake_daemon_peer_trusted(fd)) {
+        corto_throw("daemon on '%s' is not owned by the current user",
+            socket_path);
+        close(fd);
+        goto error;
+    }
+
+    return fd;
+error:
+    return -1;
+}
+
+static
+int bake_daemon_listen(
+    const char *socket_path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        corto_throw("socket path '%s' is too long", socket_path);
+        goto error;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    if (bake_daemon_socket_dir(socket_path, true)) {
+        goto error;
+    }
+
+    /* If a daemon is already serving these paths, don't replace it */
+    int fd = bake_daemon_connect(socket_path);
+    if (fd != -1) {
+        close(fd);
+        corto_throw("a daemon is already running on '%s'", socket_path);
+        goto error;
+    }
+    corto_catch();
+
+    /* Remove socket left behind by a daemon that did not exit cleanly */
+    unlink(socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        corto_throw("failed to create socket: %s", strerror(errno));
+        goto error;
+    }
+
+    /* Only allow the current user to connect */
+    mode_t mask = umask(077);
+    int ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (ret) {
+        corto_throw("failed to bind to '%s': %s", socket_path, strerror(errno));
+        close(fd);
+        goto error;
+    }
+
+    if (listen(fd, 8)) {
+        corto_throw("failed to listen on '%s': %s", socket_path, strerror(errno));
+        close(fd);
+        unlink(socket_path);
+        goto error;
+    }
+
+    return fd;
+error:
+    return -1;
+}
+
+/* Receive request and output file descriptors of client */
+static
+int16_t bake_daemon_receive(
+    int fd,
+    char *request,
+    int *fds_out)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * 2)];
+    } control;
+
+    struct iovec iov = {
+        .iov_base = request,
+        .iov_len = BAKE_DAEMON_MAX_REQUEST - 1
+    };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+
+    ssize_t n = recvmsg(fd, &msg, 0);
+    if (n <= 0) {
+        goto error;
+    }
+    request[n] = '\0';
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 2))
+    {
+        goto error;
+    }
+
+    memcpy(fds_out, CMSG_DATA(cmsg), sizeof(int) * 2);
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Run request with stdout and stderr redirected to the client. Requests with
+ * settings other than the settings of the daemon are refused, as they would
+ * be built with the wrong configuration. */
+static
+int16_t bake_daemon_handle(
+    const char *settings,
+    const char *request_settings,
+    const char *action,
+    int *fds,
+    bake_daemon_cb cb,
+    void *ctx)
+{
+    fflush(stdout);
+    fflush(stderr);
+    int saved_out = dup(STDOUT_FILENO);
+    int saved_err = dup(STDERR_FILENO);
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+
+    int16_t ret;
+    if (strcmp(settings, request_settings)) {
+        corto_throw("daemon runs with '%s', request has '%s'",
+            settings, request_settings);
+        ret = -1;
+    } else {
+        ret = cb(action, ctx);
+    }
+
+    if (ret) {
+        /* Report error to the client */
+        corto_raise();
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    return ret;
+}
+
+int16_t bake_daemon_run(
+    const char *socket_path,
+    const char *settings,
+    bake_daemon_cb cb,
+    void *ctx)
+{
+    int fd = bake_daemon_listen(socket_path);
+    if (fd == -1) {
+        goto error;
+    }
+
+    /* Clients that disconnect must not stop the daemon */
+    signal(SIGPIPE, SIG_IGN);
+
+    corto_ok("daemon listening on '%s'", socket_path);
+
+    bool stop = false;
+    while (!stop) {
+        int client = accept(fd, NULL, NULL);
+        if (client == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            corto_throw("failed to accept client: %s", strerror(errno));
+            close(fd);
+            unlink(socket_path);
+            goto error;
+        }
+
+        if (!bake_daemon_peer_trusted(client)) {
+            corto_warning("rejected client that is not the current user");
+            close(client);
+            continue;
+        }
+
+        /* Request is formatted as settings, newline, action */
+        char request[BAKE_DAEMON_MAX_REQUEST];
+        char *action = NULL;
+        int fds[2];
+        char status = 1;
+        if (!bake_daemon_receive(client, request, fds)) {
+            action = strchr(request, '\n');
+            if (!action) {
+                corto_warning("received invalid request");
+                close(fds[0]);
+                close(fds[1]);
+            } else {
+                *action = '\0';
+                action ++;
+                if (!strcmp(action, "stop") && !strcmp(request, settings)) {
+                    close(fds[0]);
+                    close(fds[1]);
+                    stop = true;
+                    status = 0;
+                } else {
+                    status = bake_daemon_handle(
+                        settings, request, action, fds, cb, ctx) ? 1 : 0;
+                }
+            }
+        } else {
+            corto_warning("received invalid request");
+        }
+
+        if (write(client, &status, 1) != 1) {
+            corto_trace("client disconnected before request finished");
+        }
+        close(client);
+    }
+
+    close(fd);
+    unlink(socket_path);
+    corto_ok("daemon stopped");
+
+    return 0;
+error:
+    return -1;
+}
+
+int16_t bake_daemon_request(
+    const char *socket_path,
+    const char *settings,
+    const char *action)
+{
+    char *request = NULL;
+
+    int fd = bake_daemon_connect(socket_path);
+    if (fd == -1) {
+        corto_throw("no daemon is running on '%s' (start with 'bake daemon')",
+            socket_path);
+        goto error;
+    }
+
+    /* Send settings, so the daemon can refuse to build with other settings */
+    request = corto_asprintf("%s\n%s", settings, action);
+    size_t len = strlen(request);
+    if (len >= BAKE_DAEMON_MAX_REQUEST) {
+        corto_throw("request '%s' is too long", action);
+        close(fd);
+        goto error;
+    }
+
+    /* Pass stdout and stderr, so the daemon writes to our terminal */
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * 2)];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = {
+        .iov_base = request,
+        .iov_len = len
+    };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 2);
+    int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(fd, &msg, 0) != (ssize_t)len) {
+        corto_throw("failed to send request to daemon: %s", strerror(errno));
+        close(fd);
+        goto error;
+    }
+
+    char status;
+    ssize_t n;
+    do {
+        n = read(fd, &status, 1);
+    } while (n == -1 && errno == EINTR);
+    close(fd);
+
+    if (n != 1) {
+        corto_throw("daemon did not complete request");
+        goto error;
+    }
+
+    if (status) {
+        corto_throw("'%s' failed", action);
+        goto error;
+    }
+
+    free(request);
+    return 0;
+error:
+    if (request) free(request);
+    return -1;
+}
@@ -0,0 +1,79 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section daemon Build daemon
+ * @brief Serves build requests from a process that keeps projects loaded.
+ *
+ * A daemon crawls its paths and loads languages once, and keeps the project
+ * graph, build databases and compiled patterns in memory between builds. A
+ * client sends an action to the daemon over a local Unix socket, together
+ * with its stdout and stderr, so that output of the build is written to the
+ * terminal of the client. Sockets are stored in a directory that only the
+ * user can access, and both ends check that the other runs as the same user.
+ *
+ * Requests include the settings of the client (like configuration and number
+ * of jobs). A daemon refuses requests of which the settings differ from the
+ * settings it was started with.
+ */
+
+/** Callback that handles a request.
+ *
+ * @param action The action requested by the client.
+ * @param ctx Context passed to bake_daemon_run.
+ * @return 0 if success, -1 if failed.
+ */
+typedef int16_t (*bake_daemon_cb)(const char *action, void *ctx);
+
+/** Get socket of daemon that serves a set of paths.
+ *
+ * @param paths List of paths passed to bake.
+ * @return Path to the socket (must be freed).
+ */
+char* bake_daemon_socket(
+    corto_ll paths);
+
+/** Serve requests until a client sends the 'stop' action.
+ *
+ * @param socket_path Path of the socket to listen on.
+ * @param settings Settings of the daemon, compared with settings of requests.
+ * @param cb Callback invoked for each request.
+ * @param ctx Context passed to callback.
+ * @return 0 if success, -1 if failed.
+ */
+int16_t bake_daemon_run(
+    const char *socket_path,
+    const char *settings,
+    bake_daemon_cb cb,
+    void *ctx);
+
+/** Send request to daemon, and wait until it is handled.
+ *
+ * @param socket_path Path of the socket of the daemon.
+ * @param settings Settings of the client.
+ * @param action Action to request.
+ * @return 0 if the action succeeded, -1 if it failed or the daemon could not
+ *         be reached.
+ */
+int16_t bake_daemon_request(
+    const char *socket_path,
+    const char *settings,
+    const char *action);
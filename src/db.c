@@ -0,0 +1,764 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#define BAKE_DB_FILE ".bake_cache/db"
+#define BAKE_DB_VERSION "bake-db 2"
+
+#define FNV_OFFSET_BASIS (14695981039346656037ULL)
+#define FNV_PRIME (1099511628211ULL)
+
+/* Content hash of a file, valid as long as timestamp and size don't change */
+typedef struct bake_db_file {
+    char *path;
+    uint64_t hash;
+    uint64_t timestamp;
+    uint64_t size;
+} bake_db_file;
+
+/* Hash of the inputs and signature of the action with which an output was built */
+typedef struct bake_db_output {
+    char *name;
+    uint64_t inputs;
+    uint64_t signature;
+} bake_db_output;
+
+/* Dependencies of an output, as parsed from a dependency file */
+typedef struct bake_db_deps {
+    char *output;
+    uint64_t timestamp; /* timestamp of dependency file when parsed */
+    corto_ll files;
+} bake_db_deps;
+
+/* Contents of a directory, valid as long as timestamp and inode don't change */
+typedef struct bake_db_dir {
+    char *path;
+    uint64_t timestamp;
+    uint64_t inode;
+    corto_ll entries;
+} bake_db_dir;
+
+struct bake_db_s {
+    bake_project *project;
+    corto_rb files;
+    corto_rb outputs;
+    corto_rb deps;
+    corto_rb dirs;
+    bake_db_deps *parsing; /* deps record to which loaded files are added */
+    bake_db_dir *parsing_dir; /* dir record to which loaded entries are added */
+    bool changed;
+    uint64_t identity[3]; /* timestamp, size and inode of file when loaded/saved */
+    struct corto_mutex_s lock;
+};
+
+static
+int bake_db_cmp(void *ctx, const void* key1, const void* key2) {
+    return strcmp(key1, key2);
+}
+
+uint64_t bake_db_hash(
+    uint64_t hash,
+    const void *data,
+    size_t size)
+{
+    const unsigned char *ptr = data;
+    size_t i;
+
+    if (!hash) {
+        hash = FNV_OFFSET_BASIS;
+    }
+
+    for (i = 0; i < size; i ++) {
+        hash ^= ptr[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static
+void bake_db_free_entries(
+    corto_ll entries)
+{
+    if (entries) {
+        corto_iter it = corto_ll_iter(entries);
+        while (corto_iter_hasNext(&it)) {
+            bake_db_entry *e = corto_iter_next(&it);
+            free(e->name);
+            free(e);
+        }
+        corto_ll_free(entries);
+    }
+}
+
+/* Remove all records */
+static
+void bake_db_clear(
+    bake_db db)
+{
+    if (db->files) {
+        corto_iter it = corto_rb_iter(db->files);
+        while (corto_iter_hasNext(&it)) {
+            bake_db_file *f = corto_iter_next(&it);
+            free(f->path);
+            free(f);
+        }
+        corto_rb_free(db->files);
+    }
+
+    if (db->outputs) {
+        corto_iter it = corto_rb_iter(db->outputs);
+        while (corto_iter_hasNext(&it)) {
+            bake_db_output *o = corto_iter_next(&it);
+            free(o->name);
+            free(o);
+        }
+        corto_rb_free(db->outputs);
+    }
+
+    if (db->deps) {
+        corto_iter it = corto_rb_iter(db->deps);
+        while (corto_iter_hasNext(&it)) {
+            bake_db_deps *d = corto_iter_next(&it);
+            bake_depfile_free(d->files);
+            free(d->output);
+            free(d);
+        }
+        corto_rb_free(db->deps);
+    }
+
+    if (db->dirs) {
+        corto_iter it = corto_rb_iter(db->dirs);
+        while (corto_iter_hasNext(&it)) {
+            bake_db_dir *d = corto_iter_next(&it);
+            bake_db_free_entries(d->entries);
+            free(d->path);
+            free(d);
+        }
+        corto_rb_free(db->dirs);
+    }
+
+    db->files = corto_rb_new(bake_db_cmp, NULL);
+    db->outputs = corto_rb_new(bake_db_cmp, NULL);
+    db->deps = corto_rb_new(bake_db_cmp, NULL);
+    db->dirs = corto_rb_new(bake_db_cmp, NULL);
+    db->parsing = NULL;
+    db->parsing_dir = NULL;
+}
+
+static
+void bake_db_set_file(
+    bake_db db,
+    const char *path,
+    uint64_t hash,
+    uint64_t timestamp,
+    uint64_t size)
+{
+    bake_db_file *f = corto_rb_find(db->files, path);
+    if (!f) {
+        f = corto_calloc(sizeof(bake_db_file));
+        f->path = corto_strdup(path);
+        corto_rb_set(db->files, f->path, f);
+    }
+    f->hash = hash;
+    f->timestamp = timestamp;
+    f->size = size;
+}
+
+static
+void bake_db_set_output(
+    bake_db db,
+    const char *name,
+    uint64_t inputs,
+    uint64_t signature)
+{
+    bake_db_output *o = corto_rb_find(db->outputs, name);
+    if (!o) {
+        o = corto_calloc(sizeof(bake_db_output));
+        o->name = corto_strdup(name);
+        corto_rb_set(db->outputs, o->name, o);
+    }
+    o->inputs = inputs;
+    o->signature = signature;
+}
+
+static
+bake_db_deps* bake_db_set_deps(
+    bake_db db,
+    const char *output,
+    uint64_t timestamp,
+    corto_ll files)
+{
+    bake_db_deps *d = corto_rb_find(db->deps, output);
+    if (!d) {
+        d = corto_calloc(sizeof(bake_db_deps));
+        d->output = corto_strdup(output);
+        corto_rb_set(db->deps, d->output, d);
+    } else {
+        bake_depfile_free(d->files);
+    }
+    d->timestamp = timestamp;
+    d->files = files;
+    return d;
+}
+
+static
+bake_db_dir* bake_db_set_dir(
+    bake_db db,
+    const char *path,
+    uint64_t timestamp,
+    uint64_t inode,
+    corto_ll entries)
+{
+    bake_db_dir *d = corto_rb_find(db->dirs, path);
+    if (!d) {
+        d = corto_calloc(sizeof(bake_db_dir));
+        d->path = corto_strdup(path);
+        corto_rb_set(db->dirs, d->path, d);
+    } else {
+        bake_db_free_entries(d->entries);
+    }
+    d->timestamp = timestamp;
+    d->inode = inode;
+    d->entries = entries;
+    return d;
+}
+
+static
+void bake_db_add_entry(
+    corto_ll entries,
+    const char *name,
+    bool is_dir)
+{
+    bake_db_entry *e = corto_alloc(sizeof(bake_db_entry));
+    e->name = corto_strdup(name);
+    e->is_dir = is_dir;
+    corto_ll_append(entries, e);
+}
+
+/* Parse a single record. Unknown records are ignored, so that a database
+ * written by a newer version can still be partially used. */
+static
+int16_t bake_db_parse_line(
+    bake_db db,
+    char *line)
+{
+    char *ptr = line;
+    char kind = ptr[0];
+
+    if (!kind) {
+        return 0;
+    }
+
+    if (ptr[1] != ' ') {
+        goto error;
+    }
+    ptr += 2;
+
+    if (kind == 'f') {
+        /* f <hash> <timestamp> <size> <path> */
+        uint64_t hash = strtoull(ptr, &ptr, 16);
+        uint64_t timestamp = strtoull(ptr, &ptr, 10);
+        uint64_t size = strtoull(ptr, &ptr, 10);
+        if (ptr[0] != ' ' || !ptr[1]) {
+            goto error;
+        }
+        bake_db_set_file(db, ptr + 1, hash, timestamp, size);
+    } else if (kind == 'o') {
+        /* o <inputs> <signature> <output> */
+        uint64_t inputs = strtoull(ptr, &ptr, 16);
+        uint64_t signature = strtoull(ptr, &ptr, 16);
+        if (ptr[0] != ' ' || !ptr[1]) {
+            goto error;
+        }
+        bake_db_set_output(db, ptr + 1, inputs, signature);
+    } else if (kind == 'd') {
+        /* d <timestamp> <output>, followed by h records */
+        uint64_t timestamp = strtoull(ptr, &ptr, 10);
+        if (ptr[0] != ' ' || !ptr[1]) {
+            goto error;
+        }
+        db->parsing = bake_db_set_deps(db, ptr + 1, timestamp, corto_ll_new());
+    } else if (kind == 'h') {
+        /* h <file> */
+        if (!db->parsing) {
+            goto error;
+        }
+        corto_ll_append(db->parsing->files, corto_strdup(ptr));
+    } else if (kind == 'l') {
+        /* l <timestamp> <inode> <directory>, followed by e records */
+        uint64_t timestamp = strtoull(ptr, &ptr, 10);
+        uint64_t inode = strtoull(ptr, &ptr, 10);
+        if (ptr[0] != ' ' || !ptr[1]) {
+            goto error;
+        }
+        db->parsing_dir = bake_db_set_dir(
+            db, ptr + 1, timestamp, inode, corto_ll_new());
+    } else if (kind == 'e') {
+        /* e <d|f> <name> */
+        if (!db->parsing_dir || (ptr[0] != 'd' && ptr[0] != 'f') ||
+            ptr[1] != ' ' || !ptr[2])
+        {
+            goto error;
+        }
+        bake_db_add_entry(db->parsing_dir->entries, ptr + 2, ptr[0] == 'd');
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Get timestamp, size and inode of database file. All zero if the file does
+ * not exist. */
+static
+void bake_db_identity(
+    const char *path,
+    uint64_t *identity)
+{
+    struct stat st;
+    if (stat(path, &st)) {
+        identity[0] = identity[1] = identity[2] = 0;
+    } else {
+        identity[0] = bake_mtime_stat(&st);
+        identity[1] = st.st_size;
+        identity[2] = st.st_ino;
+    }
+}
+
+bake_db bake_db_load(
+    bake_project *p)
+{
+    bake_db db = corto_calloc(sizeof(struct bake_db_s));
+    db->project = p;
+
+    if (corto_mutex_new(&db->lock)) {
+        corto_throw("failed to create lock for build database");
+        free(db);
+        goto error;
+    }
+
+    bake_db_clear(db);
+
+    /* Identify file before reading it, so that a file that is replaced while
+     * it is read is reported as stale */
+    char *path = bake_project_file(p, BAKE_DB_FILE);
+    bake_db_identity(path, db->identity);
+    if (corto_file_test(path) == 1) {
+        char *content = corto_file_load(path);
+        if (content) {
+            char *line = content, *next;
+            bool valid = false;
+
+            for (; line; line = next) {
+                next = strchr(line, '\n');
+                if (next) {
+                    *next = '\0';
+                    next ++;
+                }
+
+                if (!valid) {
+                    /* First line identifies format */
+                    if (strcmp(line, BAKE_DB_VERSION)) {
+                        corto_trace("ignoring build database with unknown format");
+                        break;
+                    }
+                    valid = true;
+                } else if (bake_db_parse_line(db, line)) {
+                    /* Start from scratch, which rebuilds outdated files */
+                    corto_warning("build database '%s' is corrupt, ignoring", path);
+                    bake_db_clear(db);
+                    break;
+                }
+            }
+            free(content);
+        }
+    }
+    free(path);
+
+    return db;
+error:
+    return NULL;
+}
+
+int16_t bake_db_save(
+    bake_db db)
+{
+    char *path = NULL, *tmp = NULL;
+    FILE *f = NULL;
+
+    if (!db->changed) {
+        return 0;
+    }
+
+    path = bake_project_file(db->project, BAKE_DB_FILE);
+    tmp = corto_asprintf("%s.tmp", path);
+
+    char *dir = bake_project_file(db->project, ".bake_cache");
+    if (corto_mkdir(dir)) {
+        free(dir);
+        corto_throw(NULL);
+        goto error;
+    }
+    free(dir);
+
+    /* Write to temporary file first, so an interrupted build never leaves
+     * a truncated database behind */
+    if (!(f = fopen(tmp, "w"))) {
+        corto_throw("failed to open '%s': %s", tmp, strerror(errno));
+        goto error;
+    }
+
+    fprintf(f, "%s\n", BAKE_DB_VERSION);
+
+    corto_iter it = corto_rb_iter(db->files);
+    while (corto_iter_hasNext(&it)) {
+        bake_db_file *e = corto_iter_next(&it);
+        fprintf(f, "f %016" PRIx64 " %" PRIu64 " %" PRIu64 " %s\n",
+            e->hash, e->timestamp, e->size, e->path);
+    }
+
+    it = corto_rb_iter(db->outputs);
+    while (corto_iter_hasNext(&it)) {
+        bake_db_output *e = corto_iter_next(&it);
+        fprintf(f, "o %016" PRIx64 " %016" PRIx64 " %s\n",
+            e->inputs, e->signature, e->name);
+    }
+
+    it = corto_rb_iter(db->deps);
+    while (corto_iter_hasNext(&it)) {
+        bake_db_deps *e = corto_iter_next(&it);
+        fprintf(f, "d %" PRIu64 " %s\n", e->timestamp, e->output);
+
+        corto_iter file_it = corto_ll_iter(e->files);
+        while (corto_iter_hasNext(&file_it)) {
+            fprintf(f, "h %s\n", (char*)corto_iter_next(&file_it));
+        }
+    }
+
+    it = corto_rb_iter(db->dirs);
+    while (corto_iter_hasNext(&it)) {
+        bake_db_dir *e = corto_iter_next(&it);
+        if (!e->timestamp) {
+            continue; /* listing can't be validated, don't store */
+        }
+
+        fprintf(f, "l %" PRIu64 " %" PRIu64 " %s\n",
+            e->timestamp, e->inode, e->path);
+
+        corto_iter entry_it = corto_ll_iter(e->entries);
+        while (corto_iter_hasNext(&entry_it)) {
+            bake_db_entry *entry = corto_iter_next(&entry_it);
+            fprintf(f, "e %c %s\n", entry->is_dir ? 'd' : 'f', entry->name);
+        }
+    }
+
+    if (fclose(f)) {
+        f = NULL;
+        corto_throw("failed to write '%s': %s", tmp, strerror(errno));
+        goto error;
+    }
+    f = NULL;
+
+    if (rename(tmp, path)) {
+        corto_throw("failed to move '%s' to '%s': %s", tmp, path, strerror(errno));
+        goto error;
+    }
+
+    db->changed = false;
+    bake_db_identity(path, db->identity);
+
+    free(tmp);
+    free(path);
+    return 0;
+error:
+    if (f) fclose(f);
+    if (tmp) {
+        unlink(tmp);
+        free(tmp);
+    }
+    if (path) free(path);
+    return -1;
+}
+
+bool bake_db_stale(
+    bake_db db)
+{
+    uint64_t identity[3];
+    char *path = bake_project_file(db->project, BAKE_DB_FILE);
+    bake_db_identity(path, identity);
+    free(path);
+    return memcmp(identity, db->identity, sizeof(identity)) != 0;
+}
+
+void bake_db_free(
+    bake_db db)
+{
+    if (db) {
+        bake_db_clear(db);
+        corto_rb_free(db->files);
+        corto_rb_free(db->outputs);
+        corto_rb_free(db->deps);
+        corto_rb_free(db->dirs);
+        corto_mutex_free(&db->lock);
+        free(db);
+    }
+}
+
+/* Compute hash of file contents */
+static
+uint64_t bake_db_hash_contents(
+    const char *path)
+{
+    char buffer[64 * 1024];
+    uint64_t hash = 0;
+    size_t count;
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+
+    /* Empty files still get a valid hash */
+    hash = bake_db_hash(0, NULL, 0);
+
+    while ((count = fread(buffer, 1, sizeof(buffer), f))) {
+        hash = bake_db_hash(hash, buffer, count);
+    }
+
+    if (ferror(f)) {
+        hash = 0;
+    }
+
+    fclose(f);
+
+    return hash;
+}
+
+uint64_t bake_db_file_hash(
+    bake_db db,
+    const char *file)
+{
+    struct stat st;
+    uint64_t hash = 0;
+
+    char *path = bake_project_file(db->project, file);
+    if (stat(path, &st)) {
+        goto done;
+    }
+
+    corto_mutex_lock(&db->lock);
+    bake_db_file *e = corto_rb_find(db->files, file);
+    if (e && e->timestamp == bake_mtime_stat(&st) &&
+        e->size == (uint64_t)st.st_size)
+    {
+        hash = e->hash;
+    }
+    corto_mutex_unlock(&db->lock);
+
+    if (!hash) {
+        /* File is new or changed, read contents */
+        hash = bake_db_hash_contents(path);
+        if (hash) {
+            corto_mutex_lock(&db->lock);
+            bake_db_set_file(db, file, hash, bake_mtime_stat(&st), st.st_size);
+            db->changed = true;
+            corto_mutex_unlock(&db->lock);
+        }
+    }
+
+done:
+    free(path);
+    return hash;
+}
+
+bool bake_db_file_changed(
+    bake_db db,
+    const char *file)
+{
+    struct stat st;
+    uint64_t recorded = 0;
+    bool result = true;
+
+    char *path = bake_project_file(db->project, file);
+
+    corto_mutex_lock(&db->lock);
+    bake_db_file *e = corto_rb_find(db->files, file);
+    if (e) {
+        recorded = e->hash;
+        if (!stat(path, &st) && e->timestamp == bake_mtime_stat(&st) &&
+            e->size == (uint64_t)st.st_size)
+        {
+            result = false;
+        }
+    }
+    corto_mutex_unlock(&db->lock);
+
+    /* Timestamp changed, but contents may still be the same */
+    if (result && recorded) {
+        result = bake_db_hash_contents(path) != recorded;
+    }
+
+    free(path);
+    return result;
+}
+
+bool bake_db_has_outputs(
+    bake_db db)
+{
+    corto_mutex_lock(&db->lock);
+    bool result = corto_rb_count(db->outputs) != 0;
+    corto_mutex_unlock(&db->lock);
+    return result;
+}
+
+bool bake_db_output_get(
+    bake_db db,
+    const char *output,
+    uint64_t *inputs_out,
+    uint64_t *signature_out)
+{
+    bool result = false;
+    corto_mutex_lock(&db->lock);
+    bake_db_output *o = corto_rb_find(db->outputs, output);
+    if (o) {
+        if (inputs_out) *inputs_out = o->inputs;
+        if (signature_out) *signature_out = o->signature;
+        result = true;
+    }
+    corto_mutex_unlock(&db->lock);
+    return result;
+}
+
+void bake_db_output_set(
+    bake_db db,
+    const char *output,
+    uint64_t inputs,
+    uint64_t signature)
+{
+    corto_mutex_lock(&db->lock);
+    bake_db_set_output(db, output, inputs, signature);
+    db->changed = true;
+    corto_mutex_unlock(&db->lock);
+}
+
+corto_ll bake_db_deps_get(
+    bake_db db,
+    const char *output,
+    uint64_t timestamp)
+{
+    corto_ll result = NULL;
+    corto_mutex_lock(&db->lock);
+    bake_db_deps *d = corto_rb_find(db->deps, output);
+    if (d && d->timestamp == timestamp) {
+        result = d->files;
+    }
+    corto_mutex_unlock(&db->lock);
+    return result;
+}
+
+void bake_db_deps_set(
+    bake_db db,
+    const char *output,
+    uint64_t timestamp,
+    corto_ll files)
+{
+    corto_mutex_lock(&db->lock);
+    bake_db_set_deps(db, output, timestamp, files);
+    db->changed = true;
+    corto_mutex_unlock(&db->lock);
+}
+
+/* Read contents of directory from disk */
+static
+corto_ll bake_db_read_dir(
+    const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d) {
+        return NULL;
+    }
+
+    corto_ll entries = corto_ll_new();
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+
+        struct stat st;
+        char *path = corto_asprintf("%s/%s", dir, ent->d_name);
+        bool is_dir = !stat(path, &st) && S_ISDIR(st.st_mode);
+        free(path);
+
+        bake_db_add_entry(entries, ent->d_name, is_dir);
+    }
+
+    closedir(d);
+
+    return entries;
+}
+
+corto_ll bake_db_dir_list(
+    bake_db db,
+    const char *dir)
+{
+    struct stat st;
+    corto_ll result = NULL;
+
+    if (stat(dir, &st) || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+
+    corto_mutex_lock(&db->lock);
+    bake_db_dir *d = corto_rb_find(db->dirs, dir);
+    if (d && d->timestamp && d->timestamp == (uint64_t)st.st_mtime &&
+        d->inode == (uint64_t)st.st_ino)
+    {
+        result = d->entries;
+    }
+    corto_mutex_unlock(&db->lock);
+
+    if (!result) {
+        corto_ll entries = bake_db_read_dir(dir);
+        if (entries) {
+            /* If the directory changed in the last second, it may change again
+             * without its timestamp changing, so the listing can't be trusted
+             * by the next build. */
+            uint64_t timestamp = st.st_mtime;
+            if ((time_t)timestamp >= time(NULL) - 1) {
+                timestamp = 0;
+            }
+
+            corto_mutex_lock(&db->lock);
+            d = bake_db_set_dir(db, dir, timestamp, st.st_ino, entries);
+            db->changed = true;
+            corto_mutex_unlock(&db->lock);
+            result = entries;
+        }
+    }
+
+    return result;
+}
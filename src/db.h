@@ -0,0 +1,205 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section db Build database API
+ * @brief Per-project record of input hashes, used to decide whether rules
+ *        must rerun.
+ *
+ * The database is stored in .bake_cache/db of a project. It records a content
+ * hash for input files (cached by timestamp and size, so unchanged files are
+ * not read twice) and, for every output, a hash of the inputs it was built
+ * from. A rule whose inputs appear newer than its outputs only reruns when the
+ * recorded hash differs from the hash of the current inputs.
+ *
+ * In addition, the database stores an index of the dependencies of outputs,
+ * as parsed from dependency files (like the ones emitted by compilers for
+ * header files), so that dependency files only have to be parsed when they
+ * change.
+ *
+ * Directory listings are stored as well, so that directories that did not
+ * change (same timestamp and inode) don't have to be read again.
+ */
+
+typedef struct bake_db_s* bake_db;
+
+/* Entry in a directory listing */
+typedef struct bake_db_entry {
+    char *name;
+    bool is_dir;
+} bake_db_entry;
+
+/** Load the build database of a project.
+ * If the project has no database yet, an empty database is returned.
+ *
+ * @param p The project.
+ * @return The database, or NULL if failed.
+ */
+bake_db bake_db_load(
+    bake_project *p);
+
+/** Write the database to disk if it has been modified.
+ *
+ * @param db The database.
+ * @return 0 if success, non-zero if failed.
+ */
+int16_t bake_db_save(
+    bake_db db);
+
+/** Test whether the database file was written by another process.
+ * This is the case when the timestamp, size or inode of the file changed
+ * since the database was loaded or last saved.
+ *
+ * @param db The database.
+ * @return true if the file changed, false if not.
+ */
+bool bake_db_stale(
+    bake_db db);
+
+/** Free the database.
+ *
+ * @param db The database.
+ */
+void bake_db_free(
+    bake_db db);
+
+/** Add data to a hash (64 bit FNV-1a).
+ * Start a new hash by passing 0 as hash.
+ *
+ * @param hash Hash to add to.
+ * @param data Data to hash.
+ * @param size Size of data.
+ * @return The new hash.
+ */
+uint64_t bake_db_hash(
+    uint64_t hash,
+    const void *data,
+    size_t size);
+
+/** Get content hash of a file.
+ * The file is only read if its timestamp or size changed since the hash was
+ * last computed. This function is thread safe.
+ *
+ * @param db The database.
+ * @param file Path to the file, relative to the project.
+ * @return The hash, or 0 if the file could not be read.
+ */
+uint64_t bake_db_file_hash(
+    bake_db db,
+    const char *file);
+
+/** Get record of the last build of an output.
+ * The record contains the hash of the inputs and the signature of the action
+ * (a hash of the settings that determine the command) that built the output.
+ * This function is thread safe.
+ *
+ * @param db The database.
+ * @param output Name of the output (file relative to project, or rule id).
+ * @param inputs_out Hash of the inputs (optional).
+ * @param signature_out Signature of the action (optional).
+ * @return true if the output is known, false if not.
+ */
+bool bake_db_output_get(
+    bake_db db,
+    const char *output,
+    uint64_t *inputs_out,
+    uint64_t *signature_out);
+
+/** Test whether a file changed since its content hash was last computed.
+ * Unlike bake_db_file_hash, this does not update the recorded hash. Files
+ * without a recorded hash are reported as changed. This function is thread
+ * safe.
+ *
+ * @param db The database.
+ * @param file Path to the file, relative to the project.
+ * @return true if the file changed, false if not.
+ */
+bool bake_db_file_changed(
+    bake_db db,
+    const char *file);
+
+/** Test whether the database has records of outputs.
+ * A database without records is new, or was written by an older version of
+ * bake, so outputs that exist cannot be checked against their signature.
+ *
+ * @param db The database.
+ * @return true if there are output records, false if not.
+ */
+bool bake_db_has_outputs(
+    bake_db db);
+
+/** Record with which inputs and action signature an output was built.
+ * This function is thread safe.
+ *
+ * @param db The database.
+ * @param output Name of the output (file relative to project, or rule id).
+ * @param inputs Hash of the inputs.
+ * @param signature Signature of the action.
+ */
+void bake_db_output_set(
+    bake_db db,
+    const char *output,
+    uint64_t inputs,
+    uint64_t signature);
+
+/** Get dependencies of an output.
+ * Dependencies are only returned if they were recorded for a dependency file
+ * with the specified timestamp. The returned list is owned by the database,
+ * and is valid until dependencies for the output are set again.
+ * This function is thread safe.
+ *
+ * @param db The database.
+ * @param output Name of the output.
+ * @param timestamp Current timestamp of the dependency file.
+ * @return List of files, or NULL if not found or outdated.
+ */
+corto_ll bake_db_deps_get(
+    bake_db db,
+    const char *output,
+    uint64_t timestamp);
+
+/** Record dependencies of an output.
+ * The database takes ownership of the list and its strings.
+ * This function is thread safe.
+ *
+ * @param db The database.
+ * @param output Name of the output.
+ * @param timestamp Timestamp of the dependency file.
+ * @param files List of files (strings) the output depends on.
+ */
+void bake_db_deps_set(
+    bake_db db,
+    const char *output,
+    uint64_t timestamp,
+    corto_ll files);
+
+/** Get contents of a directory.
+ * If the directory did not change since it was last read, the contents are
+ * returned from the database. The returned list is owned by the database, and
+ * is valid until the directory is read again. This function is thread safe.
+ *
+ * @param db The database.
+ * @param dir Path to the directory.
+ * @return List of bake_db_entry elements, or NULL if not a directory.
+ */
+corto_ll bake_db_dir_list(
+    bake_db db,
+    const char *dir);
@@ -0,0 +1,124 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+/* Append the current token to the list of prerequisites */
+static
+void bake_depfile_addToken(
+    corto_ll deps,
+    corto_buffer *token,
+    bool *has_token)
+{
+    if (*has_token) {
+        corto_ll_append(deps, corto_buffer_str(token));
+        *token = (corto_buffer)CORTO_BUFFER_INIT;
+        *has_token = false;
+    }
+}
+
+corto_ll bake_depfile_parse(
+    const char *file)
+{
+    char *content = corto_file_load(file);
+    if (!content) {
+        return NULL;
+    }
+
+    corto_ll deps = corto_ll_new();
+    corto_buffer token = CORTO_BUFFER_INIT;
+    bool has_token = false;
+    bool in_prereqs = false; /* true after the ':' of the first rule */
+    char *ptr;
+
+    for (ptr = content; *ptr; ptr ++) {
+        char ch = *ptr;
+
+        if (ch == '\\') {
+            char next = ptr[1];
+            if (next == '\n' || (next == '\r' && ptr[2] == '\n')) {
+                /* Line continuation */
+                bake_depfile_addToken(deps, &token, &has_token);
+                ptr += next == '\r' ? 2 : 1;
+                continue;
+            } else if (next == ' ' || next == '#' || next == '\\') {
+                /* Escaped character */
+                if (in_prereqs) {
+                    corto_buffer_appendstrn(&token, &next, 1);
+                    has_token = true;
+                }
+                ptr ++;
+                continue;
+            }
+        } else if (ch == '$' && ptr[1] == '$') {
+            if (in_prereqs) {
+                corto_buffer_appendstrn(&token, "$", 1);
+                has_token = true;
+            }
+            ptr ++;
+            continue;
+        } else if (ch == '\n') {
+            /* End of rule. Only the first rule contains dependencies. */
+            if (in_prereqs) {
+                break;
+            }
+            continue;
+        } else if (ch == ' ' || ch == '\t' || ch == '\r') {
+            if (in_prereqs) {
+                bake_depfile_addToken(deps, &token, &has_token);
+            }
+            continue;
+        } else if (ch == ':' && !in_prereqs) {
+            /* Separator between targets and prerequisites. A colon that is
+             * not followed by whitespace is part of a (windows) path. */
+            char next = ptr[1];
+            if (!next || next == ' ' || next == '\t' || next == '\n' ||
+                next == '\r' || next == '\\')
+            {
+                in_prereqs = true;
+            }
+            continue;
+        }
+
+        if (in_prereqs) {
+            corto_buffer_appendstrn(&token, ptr, 1);
+            has_token = true;
+        }
+    }
+
+    bake_depfile_addToken(deps, &token, &has_token);
+
+    free(content);
+
+    return deps;
+}
+
+void bake_depfile_free(
+    corto_ll deps)
+{
+    if (deps) {
+        corto_iter it = corto_ll_iter(deps);
+        while (corto_iter_hasNext(&it)) {
+            free(corto_iter_next(&it));
+        }
+        corto_ll_free(deps);
+    }
+}
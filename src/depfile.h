@@ -0,0 +1,43 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section depfile Parser for make-style dependency files.
+ * @brief Reads dependency files as emitted by compilers (-MMD, -MD).
+ */
+
+/** Parse a dependency file.
+ * Returns the prerequisites of the first rule in the file. Rules added for
+ * headers by -MP (which have no prerequisites) are ignored. Line continuations,
+ * escaped spaces and escaped dollar signs are supported.
+ *
+ * @param file Path to the dependency file.
+ * @return List of prerequisites (strings), or NULL if the file couldn't be read.
+ */
+corto_ll bake_depfile_parse(
+    const char *file);
+
+/** Free list returned by bake_depfile_parse.
+ *
+ * @param deps List of prerequisites.
+ */
+void bake_depfile_free(
+    corto_ll deps);
@@ -0,0 +1,346 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+/* Required for getdents64, fstatat and statx */
+#define _GNU_SOURCE
+#endif
+
+#include "bake.h"
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+/* Record returned by getdents64, glibc does not define this type */
+struct bake_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+typedef struct bake_dircache_dir {
+    char *path;
+    bake_dircache_entry *entries;
+    int32_t count;
+} bake_dircache_dir;
+
+struct bake_dircache_s {
+    bake_db db;
+    corto_rb dirs;
+    corto_ll invalidated; /* listings that may still be used by callers */
+    struct corto_mutex_s lock;
+};
+
+static
+int bake_dircache_cmp(void *ctx, const void* key1, const void* key2) {
+    return strcmp(key1, key2);
+}
+
+bake_dircache bake_dircache_new(
+    bake_db db)
+{
+    bake_dircache result = corto_alloc(sizeof(struct bake_dircache_s));
+    result->db = db;
+    result->dirs = corto_rb_new(bake_dircache_cmp, NULL);
+    result->invalidated = corto_ll_new();
+    corto_mutex_new(&result->lock);
+    return result;
+}
+
+static
+void bake_dircache_dir_free(
+    bake_dircache_dir *d)
+{
+    int32_t i;
+    for (i = 0; i < d->count; i ++) {
+        free(d->entries[i].name);
+    }
+    free(d->entries);
+    free(d->path);
+    free(d);
+}
+
+void bake_dircache_free(
+    bake_dircache cache)
+{
+    bake_dircache_invalidate(cache);
+
+    corto_iter it = corto_ll_iter(cache->invalidated);
+    while (corto_iter_hasNext(&it)) {
+        bake_dircache_dir_free(corto_iter_next(&it));
+    }
+    corto_ll_free(cache->invalidated);
+    corto_rb_free(cache->dirs);
+    corto_mutex_free(&cache->lock);
+    free(cache);
+}
+
+/* Entry type, if known from reading the directory */
+typedef enum bake_dircache_type {
+    BAKE_DIRCACHE_UNKNOWN,
+    BAKE_DIRCACHE_FILE,
+    BAKE_DIRCACHE_DIR
+} bake_dircache_type;
+
+/* Get modification time and type of entry. On Linux the entry is resolved
+ * relative to the directory file descriptor, which avoids formatting a path and
+ * resolving the directory again for each entry. */
+static
+int16_t bake_dircache_stat(
+    int fd,
+    const char *dir,
+    const char *name,
+    bake_dircache_type type,
+    bool *is_dir_out,
+    uint64_t *timestamp_out)
+{
+#ifdef __linux__
+#ifdef STATX_MTIME
+    struct statx stx;
+    unsigned int mask = STATX_MTIME;
+    if (type == BAKE_DIRCACHE_UNKNOWN) {
+        mask |= STATX_TYPE;
+    }
+    if (!statx(fd, name, AT_STATX_SYNC_AS_STAT, mask, &stx)) {
+        if (type == BAKE_DIRCACHE_UNKNOWN) {
+            *is_dir_out = S_ISDIR(stx.stx_mode);
+        } else {
+            *is_dir_out = type == BAKE_DIRCACHE_DIR;
+        }
+        *timestamp_out = (uint64_t)stx.stx_mtime.tv_sec * 1000000000ull +
+            stx.stx_mtime.tv_nsec;
+        return 0;
+    }
+
+    /* Older kernels don't have statx, and seccomp filters of containers may
+     * reject it, so fall back to fstatat */
+    if (errno != ENOSYS && errno != EPERM && errno != EINVAL) {
+        return -1;
+    }
+#endif
+    struct stat st;
+    if (fstatat(fd, name, &st, 0)) {
+        return -1;
+    }
+    *is_dir_out = S_ISDIR(st.st_mode);
+    *timestamp_out = bake_mtime_stat(&st);
+    return 0;
+#else
+    struct stat st;
+    char *path = corto_asprintf("%s/%s", dir, name);
+    int ret = stat(path, &st);
+    free(path);
+    if (ret) {
+        return -1;
+    }
+    *is_dir_out = S_ISDIR(st.st_mode);
+    *timestamp_out = bake_mtime_stat(&st);
+    return 0;
+#endif
+}
+
+/* Add entry to listing, obtain its status from the filesystem */
+static
+void bake_dircache_add(
+    bake_dircache_dir *d,
+    int32_t *size,
+    int fd,
+    const char *name,
+    bake_dircache_type type)
+{
+    if (d->count == *size) {
+        *size = *size ? *size * 2 : 16;
+        d->entries = realloc(d->entries, *size * sizeof(bake_dircache_entry));
+    }
+
+    bake_dircache_entry *e = &d->entries[d->count ++];
+    e->name = corto_strdup(name);
+    if (bake_dircache_stat(fd, d->path, name, type, &e->is_dir, &e->timestamp)) {
+        /* Entry was removed while reading directory */
+        e->is_dir = false;
+        e->timestamp = 0;
+    }
+}
+
+#ifdef __linux__
+/* Read entries from directory file descriptor. The entry type is obtained from
+ * the directory itself, so only the modification time has to be requested. */
+static
+int16_t bake_dircache_readfd(
+    bake_dircache_dir *d,
+    int32_t *size,
+    int fd)
+{
+    char buf[32 * 1024];
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (n < 0) {
+            goto error;
+        } else if (!n) {
+            break;
+        }
+
+        long pos = 0;
+        while (pos < n) {
+            struct bake_dirent64 *ent = (struct bake_dirent64*)(buf + pos);
+            pos += ent->d_reclen;
+
+            const char *name = ent->d_name;
+            if (name[0] == '.' &&
+                (!name[1] || (name[1] == '.' && !name[2])))
+            {
+                continue;
+            }
+
+            bake_dircache_type type = BAKE_DIRCACHE_UNKNOWN;
+            if (ent->d_type == DT_DIR) {
+                type = BAKE_DIRCACHE_DIR;
+            } else if (ent->d_type == DT_REG) {
+                type = BAKE_DIRCACHE_FILE;
+            }
+
+            bake_dircache_add(d, size, fd, name, type);
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+#endif
+
+/* Read directory, from build database if available */
+static
+bake_dircache_dir* bake_dircache_read(
+    bake_dircache cache,
+    const char *dir)
+{
+    bake_dircache_dir *result = corto_calloc(sizeof(bake_dircache_dir));
+    int32_t size = 0;
+    int fd = -1;
+    result->path = corto_strdup(dir);
+
+#ifdef __linux__
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        goto error;
+    }
+#endif
+
+    if (cache->db) {
+        corto_ll entries = bake_db_dir_list(cache->db, dir);
+        if (!entries) {
+            goto error;
+        }
+
+        corto_iter it = corto_ll_iter(entries);
+        while (corto_iter_hasNext(&it)) {
+            bake_db_entry *e = corto_iter_next(&it);
+            bake_dircache_add(result, &size, fd, e->name,
+                e->is_dir ? BAKE_DIRCACHE_DIR : BAKE_DIRCACHE_FILE);
+        }
+    } else {
+#ifdef __linux__
+        if (bake_dircache_readfd(result, &size, fd)) {
+            goto error;
+        }
+#else
+        DIR *d = opendir(dir);
+        if (!d) {
+            goto error;
+        }
+
+        struct dirent *ent;
+        while ((ent = readdir(d))) {
+            if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+                continue;
+            }
+            bake_dircache_add(result, &size, fd, ent->d_name,
+                BAKE_DIRCACHE_UNKNOWN);
+        }
+
+        closedir(d);
+#endif
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+
+    return result;
+error:
+    if (fd != -1) {
+        close(fd);
+    }
+    bake_dircache_dir_free(result);
+    return NULL;
+}
+
+int32_t bake_dircache_list(
+    bake_dircache cache,
+    const char *dir,
+    bake_dircache_entry **entries_out)
+{
+    corto_mutex_lock(&cache->lock);
+    bake_dircache_dir *d = corto_rb_find(cache->dirs, dir);
+    corto_mutex_unlock(&cache->lock);
+
+    if (!d) {
+        bake_dircache_dir *read = bake_dircache_read(cache, dir);
+        if (!read) {
+            return -1;
+        }
+
+        /* Another thread may have read the same directory */
+        corto_mutex_lock(&cache->lock);
+        d = corto_rb_findOrSet(cache->dirs, read->path, read);
+        if (!d) {
+            d = read;
+        } else if (d != read) {
+            bake_dircache_dir_free(read);
+        }
+        corto_mutex_unlock(&cache->lock);
+    }
+
+    *entries_out = d->entries;
+    return d->count;
+}
+
+void bake_dircache_invalidate(
+    bake_dircache cache)
+{
+    corto_mutex_lock(&cache->lock);
+    corto_iter it = corto_rb_iter(cache->dirs);
+    while (corto_iter_hasNext(&it)) {
+        corto_ll_append(cache->invalidated, corto_iter_next(&it));
+    }
+    corto_rb_free(cache->dirs);
+    cache->dirs = corto_rb_new(bake_dircache_cmp, NULL);
+    corto_mutex_unlock(&cache->lock);
+}
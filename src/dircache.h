@@ -0,0 +1,78 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section dircache Directory cache
+ * @brief Caches directory listings for the duration of a build.
+ *
+ * Patterns of rules are matched against the same directories many times in a
+ * single build. The directory cache reads a directory and the status of its
+ * entries once, after which patterns are matched against the cached listing.
+ * Since actions may add or remove files, listings are invalidated after an
+ * action ran.
+ */
+
+typedef struct bake_dircache_s* bake_dircache;
+
+/* Entry in a cached directory listing */
+typedef struct bake_dircache_entry {
+    char *name;
+    bool is_dir;
+    uint64_t timestamp; /* last modified time of entry */
+} bake_dircache_entry;
+
+/** Create a new directory cache.
+ *
+ * @param db Optional build database from which to load directory listings.
+ * @return The new directory cache.
+ */
+bake_dircache bake_dircache_new(
+    bake_db db);
+
+/** Free a directory cache.
+ *
+ * @param cache The directory cache.
+ */
+void bake_dircache_free(
+    bake_dircache cache);
+
+/** Get contents of a directory.
+ * The returned entries are owned by the cache, and remain valid until the
+ * cache is freed. This function is thread safe.
+ *
+ * @param cache The directory cache.
+ * @param dir Path to the directory.
+ * @param entries_out Out parameter for array with entries.
+ * @return Number of entries, or -1 if not a directory.
+ */
+int32_t bake_dircache_list(
+    bake_dircache cache,
+    const char *dir,
+    bake_dircache_entry **entries_out);
+
+/** Invalidate cached directory listings.
+ * Directories are read again when they are listed after this function is
+ * called. This function is thread safe.
+ *
+ * @param cache The directory cache.
+ */
+void bake_dircache_invalidate(
+    bake_dircache cache);
@@ -0,0 +1,117 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+#include <sys/types.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+/* Combine environment of bake process with additional variables. The array is
+ * created before forking, as the child may not allocate memory. */
+static
+char** bake_exec_env(
+    char *const env[])
+{
+    int i, j, k, count = 0, env_count = 0;
+    while (environ[count]) count ++;
+    while (env[env_count]) env_count ++;
+
+    char **result = malloc((count + env_count + 1) * sizeof(char*));
+    if (!result) {
+        return NULL;
+    }
+
+    for (k = 0; k < env_count; k ++) {
+        result[k] = env[k];
+    }
+
+    for (j = 0; j < count; j ++) {
+        /* Skip variables that are overridden */
+        bool overridden = false;
+        for (i = 0; i < env_count && !overridden; i ++) {
+            const char *eq = strchr(env[i], '=');
+            size_t len = eq ? eq - env[i] + 1 : strlen(env[i]);
+            overridden = !strncmp(environ[j], env[i], len);
+        }
+        if (!overridden) {
+            result[k ++] = environ[j];
+        }
+    }
+
+    result[k] = NULL;
+
+    return result;
+}
+
+int bake_exec(
+    const char *cwd,
+    const char *cmd,
+    char *const env[],
+    int8_t *rc_out)
+{
+    char **envp = environ;
+    if (env) {
+        if (!(envp = bake_exec_env(env))) {
+            corto_throw("out of memory");
+            goto error;
+        }
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        corto_throw("failed to fork for '%s': %s", cmd, strerror(errno));
+        goto error;
+    }
+
+    if (!pid) {
+        /* Child process: only use async-signal-safe functions until exec */
+        if (cwd && chdir(cwd)) {
+            _exit(127);
+        }
+        execle("/bin/sh", "sh", "-c", cmd, (char*)NULL, envp);
+        _exit(127);
+    }
+
+    if (envp != environ) {
+        free(envp);
+        envp = environ;
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            corto_throw("failed to wait for '%s': %s", cmd, strerror(errno));
+            goto error;
+        }
+    }
+
+    if (WIFSIGNALED(status)) {
+        return WTERMSIG(status);
+    }
+
+    *rc_out = WEXITSTATUS(status);
+
+    return 0;
+error:
+    if (envp != environ) free(envp);
+    return -1;
+}
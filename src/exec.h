@@ -0,0 +1,43 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section exec Run commands for a project
+ * @brief Runs shell commands in a project directory without changing the
+ *        working directory of the bake process.
+ */
+
+/** Run a shell command in a directory.
+ * The command is executed by /bin/sh in a child process, which changes to the
+ * specified directory before running the command. This allows commands for
+ * multiple projects to run at the same time.
+ *
+ * @param cwd Directory in which to run the command (NULL for current).
+ * @param cmd The command to run.
+ * @param env NULL-terminated list of NAME=value pairs to add to environment, or NULL.
+ * @param rc_out Return code of the command.
+ * @return 0 if command ran, signal if command was killed, -1 if command could not run.
+ */
+int bake_exec(
+    const char *cwd,
+    const char *cmd,
+    char *const env[],
+    int8_t *rc_out);
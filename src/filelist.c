@@ -1,164 +1,339 @@
 
 #include "bake.h"
+#include <inttypes.h>
 
 extern corto_tls BAKE_FILELIST_KEY;
+extern corto_tls BAKE_PROJECT_KEY;
+extern corto_tls BAKE_ARENA_KEY;
 
-bake_file* bake_file_copy(
-    bake_file *file)
+/* Get arena of the current thread. When no filelists use the arena, memory of
+ * files from a previous build is reused. */
+static
+bake_arena bake_filelist_arena(void)
 {
-    bake_file *result = malloc(sizeof(bake_file));
-    result->name = corto_strdup(file->name);
-    result->offset = file->offset ? corto_strdup(file->offset) : NULL;
-    result->timestamp = file->timestamp;
-    return result;
+    bake_arena arena = corto_tls_get(BAKE_ARENA_KEY);
+    if (!arena) {
+        arena = bake_arena_new();
+        bake_arena_keep(arena); /* Reference held by the thread */
+        corto_tls_set(BAKE_ARENA_KEY, arena);
+    } else if (bake_arena_users(arena) == 1) {
+        bake_arena_reset(arena);
+    }
+
+    bake_arena_keep(arena);
+    return arena;
 }
 
 void bake_filelist_free(
     bake_filelist *fl)
 {
+    if (fl->root) {
+        free(fl->root);
+    }
     if (fl->pattern) {
         free(fl->pattern);
     }
     if (fl->files) {
-        corto_iter it = corto_ll_iter(fl->files);
-        while (corto_iter_hasNext(&it)) {
-            bake_file *f = corto_iter_next(&it);
-            if (f->name) free(f->name);
-            free(f);
-        }
-        corto_ll_free(fl->files);
+        free(fl->files);
     }
+    bake_arena_release(fl->arena);
     free(fl);
 }
 
+/* Make room for count additional files */
 static
-bake_file* bake_filelist_add_intern(
+void bake_filelist_reserve(
     bake_filelist *fl,
-    const char *filename,
-    const char *offset,
-    time_t timestamp)
+    uint32_t count)
 {
-    if (timestamp < 0) {
-        corto_throw(NULL);
-        goto error;
+    if (fl->count + count > fl->size) {
+        uint32_t size = fl->size ? fl->size : 16;
+        while (size < fl->count + count) {
+            size *= 2;
+        }
+        fl->files = realloc(fl->files, size * sizeof(bake_file*));
+        fl->size = size;
     }
+}
 
-    bake_file *bfile = corto_alloc(sizeof(bake_file));
-    bfile->name = corto_strdup(filename);
-    bfile->offset = offset ? corto_strdup(offset) : NULL;
-    bfile->timestamp = timestamp;
+/* Resolve file (or directory if file is NULL) against root & offset */
+static
+char* bake_filelist_path(
+    bake_filelist *fl,
+    const char *offset,
+    const char *file)
+{
+    corto_buffer buf = CORTO_BUFFER_INIT;
+    int count = 0;
 
-    if (!fl->files) {
-        fl->files = corto_ll_new();
+    if (fl->root && !(offset && offset[0] == '/') && !(file && file[0] == '/')) {
+        corto_buffer_appendstr(&buf, fl->root);
+        count ++;
+    }
+    if (offset && !(file && file[0] == '/')) {
+        if (count) corto_buffer_appendstr(&buf, "/");
+        corto_buffer_appendstr(&buf, (char*)offset);
+        count ++;
+    }
+    if (file && file[0]) {
+        if (count) corto_buffer_appendstr(&buf, "/");
+        corto_buffer_appendstr(&buf, (char*)file);
+        count ++;
     }
-    corto_ll_append(fl->files, bfile);
 
-    if (timestamp) {
-        corto_debug("add '%s' with timestamp %d", filename, timestamp);
+    if (!count) {
+        return corto_strdup(".");
     } else {
-        corto_debug("add '%s' with timestamp 0", filename);
+        return corto_buffer_str(&buf);
     }
+}
 
-    return bfile;
-error: 
-    return NULL;
+/* Update aggregated timestamps with a file that is added to the list */
+static
+void bake_filelist_aggregate(
+    bake_filelist *fl,
+    uint64_t timestamp)
+{
+    if (!timestamp) {
+        fl->missing = true;
+    } else {
+        if (timestamp > fl->newest) {
+            fl->newest = timestamp;
+        }
+        if (!fl->oldest || timestamp < fl->oldest) {
+            fl->oldest = timestamp;
+        }
+    }
 }
 
 static
-int16_t bake_filelist_populate(
+bake_file* bake_filelist_add_intern(
     bake_filelist *fl,
+    const char *filename,
     const char *offset,
-    const char *pattern)
+    uint64_t timestamp)
 {
-    char *dir = NULL;
-    bool skip = false;
-
-    /* Optimize filter evaluation by extracting static path from pattern */
-    const char *ptr = pattern, *end = pattern;
-    char ch;
-    while ((ch = *ptr)) {
-        if (ch == '/') {
-            if (ptr[1] == '/') {
-                end = ptr;
-                break;
-            } else {
-                end = ptr;
-            }
-        } else if (corto_idmatch_isOperator(ch)) {
-            break;
+    bake_file *bfile = bake_arena_alloc(fl->arena, sizeof(bake_file));
+    bfile->name = bake_arena_strdup(fl->arena, filename);
+    bfile->offset = NULL;
+    bfile->timestamp = timestamp;
+
+    /* Files matched by the same pattern share the offset */
+    if (offset) {
+        bake_file *last = fl->count ? fl->files[fl->count - 1] : NULL;
+        if (last && last->offset && !strcmp(last->offset, offset)) {
+            bfile->offset = last->offset;
+        } else {
+            bfile->offset = bake_arena_strdup(fl->arena, offset);
         }
-        ptr ++;
     }
 
-    corto_iter it;
-    if (end != pattern) {
-        dir = strdup(pattern);
-        dir[end - pattern] = '\0';
+    bake_filelist_reserve(fl, 1);
+    fl->files[fl->count ++] = bfile;
+    bake_filelist_aggregate(fl, timestamp);
 
-        if (end[-1] == '/') {
-            end --;
-        } else {
-            end ++;
-            if (!*end) {
-                end = "*";
+    corto_debug("add '%s' with timestamp %" PRIu64, filename, timestamp);
+
+    return bfile;
+}
+
+/* Get directory cache of the project that is being built */
+static
+bake_dircache bake_filelist_dircache(void)
+{
+    bake_project *p = corto_tls_get(BAKE_PROJECT_KEY);
+    if (p) {
+        return p->dircache;
+    }
+    return NULL;
+}
+
+/* Add files matching filter from cached directory listings */
+static
+int16_t bake_filelist_collect(
+    bake_filelist *fl,
+    bake_dircache cache,
+    const char *offset,
+    const char *dir,
+    const char *rel,
+    bake_matcher m,
+    int *count)
+{
+    bake_dircache_entry *entries;
+    int32_t i, entry_count = bake_dircache_list(cache, dir, &entries);
+
+    for (i = 0; i < entry_count; i ++) {
+        bake_dircache_entry *e = &entries[i];
+        char *path = (rel && rel[0])
+            ? corto_asprintf("%s/%s", rel, e->name)
+            : corto_strdup(e->name)
+            ;
+
+        if (bake_matcher_match(m, e->name)) {
+            if (!bake_filelist_add_intern(fl, path, offset, e->timestamp)) {
+                free(path);
+                goto error;
             }
+            (*count) ++;
         }
 
-        corto_trace("match pattern '%s' in '%s/%s'", end, corto_cwd(), dir);
-        if (corto_file_test(dir)) {
-            if (corto_dir_iter(dir, end, &it)) {
-                corto_throw(NULL);
+        if (e->is_dir && m->recursive) {
+            char *subdir = corto_asprintf("%s/%s", dir, e->name);
+            int16_t ret = bake_filelist_collect(
+                fl, cache, offset, subdir, path, m, count);
+            free(subdir);
+            if (ret) {
+                free(path);
                 goto error;
             }
-        } else {
-            corto_trace("directory '%s' does not exist, skipping pattern", dir);
-            skip = true;
+        }
+
+        free(path);
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Add files matching pattern in directory. Uses directory listings cached for
+ * the current build when possible. */
+static
+int16_t bake_filelist_match(
+    bake_filelist *fl,
+    const char *offset,
+    const char *base,
+    bake_matcher m,
+    int *count)
+{
+    bake_dircache cache = bake_filelist_dircache();
+    const char *dir = m->dir;
+    char *fulldir = dir ? corto_asprintf("%s/%s", base, dir) : corto_strdup(base);
+
+    corto_trace("match pattern '%s' in '%s'", m->filter, fulldir);
+
+    if (cache && m->program) {
+        if (bake_filelist_collect(fl, cache, offset, fulldir, dir, m, count)) {
+            goto error;
         }
     } else {
-        corto_trace("match pattern '%s' in '%s'", pattern, corto_cwd());
-        if (corto_dir_iter(".", pattern, &it)) {
-            corto_throw(NULL);
+        corto_iter it;
+        if (corto_dir_iter(fulldir, m->filter, &it)) {
             goto error;
         }
-    }
 
-    /* Iterate directory, add matched files */
-    if (!skip) {
-        int count = 0;
         while (corto_iter_hasNext(&it)) {
             char *file = corto_iter_next(&it);
             char *path = (dir && dir[0]) ? corto_asprintf("%s/%s", dir, file) : strdup(file);
-            if (!bake_filelist_add_intern(fl, path, offset, corto_lastmodified(path))) {
+            char *fullpath = corto_asprintf("%s/%s", base, path);
+            uint64_t timestamp = bake_mtime(fullpath);
+            free(fullpath);
+            if (!bake_filelist_add_intern(fl, path, offset, timestamp)) {
                 free(path);
-                corto_throw(NULL);
+                corto_iter_release(&it);
                 goto error;
             }
             free(path);
-            count ++;
+            (*count) ++;
         }
+    }
 
-        if (!count && !corto_idmatch_hasOperators(end)) {
-            char *path = dir ? corto_asprintf("%s/%s", dir, end) : strdup(end);
-            if (!bake_filelist_add_intern(fl, path, offset, 0)) {
-                free(path);
-                corto_throw(NULL);
-                goto error;
-            }
-            free(path);
+    free(fulldir);
+    return 0;
+error:
+    free(fulldir);
+    return -1;
+}
+
+static
+int16_t bake_filelist_populate(
+    bake_filelist *fl,
+    const char *offset,
+    const char *pattern)
+{
+    char *base = bake_filelist_path(fl, offset, NULL);
+    int count = 0;
+
+    /* Patterns are compiled once, and shared between filelists */
+    bake_matcher m = bake_matcher_get(pattern);
+    if (!m) {
+        corto_throw(NULL);
+        goto error;
+    }
+
+    if (m->dir) {
+        char *fulldir = corto_asprintf("%s/%s", base, m->dir);
+        bool exists = corto_file_test(fulldir);
+        free(fulldir);
+        if (!exists) {
+            corto_trace("directory '%s' does not exist, skipping pattern", m->dir);
+            free(base);
+            return 0;
         }
     }
 
-   if (dir) free(dir); 
+    /* Add matched files */
+    if (bake_filelist_match(fl, offset, base, m, &count)) {
+        corto_throw(NULL);
+        goto error;
+    }
+
+    /* If pattern identifies a single file that doesn't exist, add it so that
+     * rules know the file has to be created */
+    if (!count && !m->has_operators) {
+        char *path = m->dir
+            ? corto_asprintf("%s/%s", m->dir, m->filter)
+            : corto_strdup(m->filter)
+            ;
+        bake_filelist_add_intern(fl, path, offset, 0);
+        free(path);
+    }
+
+    free(base);
     return 0;
 error:
-    if (dir) free(dir);
+    free(base);
     return -1;
 }
 
+static
+int bake_filelist_iter_hasNext(
+    corto_iter *it)
+{
+    bake_filelist *fl = it->ctx;
+    return (uintptr_t)it->data < fl->count;
+}
+
+static
+void* bake_filelist_iter_next(
+    corto_iter *it)
+{
+    bake_filelist *fl = it->ctx;
+    uintptr_t index = (uintptr_t)it->data;
+    it->data = (void*)(index + 1);
+    return fl->files[index];
+}
+
 corto_iter bake_filelist_iter(
     bake_filelist *fl)
 {
-    return corto_ll_iterAlloc(fl->files);
+    corto_iter result = {
+        .ctx = fl,
+        .data = (void*)(uintptr_t)0,
+        .hasNext = bake_filelist_iter_hasNext,
+        .next = bake_filelist_iter_next
+    };
+    return result;
+}
+
+bake_file* bake_filelist_get(
+    bake_filelist *fl,
+    uint32_t index)
+{
+    if (index >= fl->count) {
+        return NULL;
+    }
+    return fl->files[index];
 }
 
 int16_t bake_filelist_set(
@@ -189,9 +364,16 @@ bake_filelist* bake_filelist_new(
     const char *pattern)
 {
     bake_filelist *result = corto_alloc(sizeof(bake_filelist));
+    result->root = path ? strdup(path) : NULL;
     result->pattern = pattern ? strdup(pattern) : NULL;
-    result->files = corto_ll_new();
+    result->files = NULL;
+    result->count = 0;
+    result->size = 0;
+    result->arena = bake_filelist_arena();
     result->set = bake_filelist_set_cb;
+    result->newest = 0;
+    result->oldest = 0;
+    result->missing = false;
 
     /* Extract starting directory from pattern */
     if (pattern) {
@@ -213,11 +395,12 @@ bake_file* bake_filelist_add(
 {
     corto_assert(fl != NULL, "passed NULL filelist to filelist_add");
     corto_assert(file != NULL, "passed NULL file to filelist_add");
-    if (corto_file_test(file)) {
-        return bake_filelist_add_intern(fl, file, NULL, corto_lastmodified(file));
-    } else {
-        return bake_filelist_add_intern(fl, file, NULL, 0);
-    }
+    char *path = bake_filelist_path(fl, NULL, file);
+
+    /* Timestamp is 0 if file does not exist */
+    bake_file *result = bake_filelist_add_intern(fl, file, NULL, bake_mtime(path));
+    free(path);
+    return result;
 }
 
 int16_t bake_filelist_addPattern(
@@ -251,9 +434,34 @@ int16_t bake_filelist_addList(
         goto error;
     }
 
-    corto_iter it = corto_ll_iter(src->files);
-    while (corto_iter_hasNext(&it)) {
-        corto_ll_append(fl->files, bake_file_copy(corto_iter_next(&it)));
+    bake_filelist_reserve(fl, src->count);
+
+    if (src->arena == fl->arena) {
+        /* Files in the same arena are not modified, and can be shared */
+        memcpy(&fl->files[fl->count], src->files, src->count * sizeof(bake_file*));
+        fl->count += src->count;
+    } else {
+        uint32_t i;
+        for (i = 0; i < src->count; i ++) {
+            bake_file *f = src->files[i];
+            bake_file *copy = bake_arena_alloc(fl->arena, sizeof(bake_file));
+            copy->name = bake_arena_strdup(fl->arena, f->name);
+            copy->offset = f->offset ? bake_arena_strdup(fl->arena, f->offset) : NULL;
+            copy->timestamp = f->timestamp;
+            fl->files[fl->count ++] = copy;
+        }
+    }
+
+    if (bake_filelist_count(src)) {
+        if (src->missing) {
+            fl->missing = true;
+        }
+        if (src->newest > fl->newest) {
+            fl->newest = src->newest;
+        }
+        if (src->oldest && (!fl->oldest || src->oldest < fl->oldest)) {
+            fl->oldest = src->oldest;
+        }
     }
 
     return 0;
@@ -264,6 +472,35 @@ error:
 uint64_t bake_filelist_count(
     bake_filelist *fl)
 {
-    return corto_ll_count(fl->files);
+    return fl->count;
+}
+
+
+void bake_filelist_refresh(
+    bake_filelist *fl)
+{
+    uint32_t i;
+
+    fl->newest = 0;
+    fl->oldest = 0;
+    fl->missing = false;
+
+    for (i = 0; i < fl->count; i ++) {
+        bake_filelist_aggregate(fl, fl->files[i]->timestamp);
+    }
 }
 
+void bake_filelist_update(
+    bake_filelist *fl)
+{
+    uint32_t i;
+
+    for (i = 0; i < fl->count; i ++) {
+        bake_file *f = fl->files[i];
+        char *path = bake_filelist_path(fl, f->offset, f->name);
+        f->timestamp = bake_mtime(path);
+        free(path);
+    }
+
+    bake_filelist_refresh(fl);
+}
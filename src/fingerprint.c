@@ -0,0 +1,333 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#define BAKE_FINGERPRINTS_VERSION "bake-fingerprints 2"
+
+/* Fingerprint of a project, as stored and as computed for this build. Each
+ * configuration of a project has its own fingerprint, as it is built to a
+ * different location. */
+typedef struct bake_fingerprint {
+    char *id; /* environment:configuration:project */
+    uint64_t stored;
+    uint64_t current;
+} bake_fingerprint;
+
+struct bake_fingerprints_s {
+    char *file;
+    corto_rb projects;
+};
+
+static
+int bake_fingerprint_cmp(void *ctx, const void* key1, const void* key2) {
+    return strcmp(key1, key2);
+}
+
+static
+bake_fingerprint* bake_fingerprints_get(
+    bake_fingerprints fp,
+    const char *id)
+{
+    bake_fingerprint *e = corto_rb_find(fp->projects, id);
+    if (!e) {
+        e = corto_calloc(sizeof(bake_fingerprint));
+        e->id = corto_strdup(id);
+        corto_rb_set(fp->projects, e->id, e);
+    }
+    return e;
+}
+
+bake_fingerprints bake_fingerprints_load(
+    const char *file)
+{
+    bake_fingerprints fp = corto_alloc(sizeof(struct bake_fingerprints_s));
+    fp->file = corto_strdup(file);
+    fp->projects = corto_rb_new(bake_fingerprint_cmp, NULL);
+
+    if (corto_file_test(file) != 1) {
+        return fp;
+    }
+
+    char *content = corto_file_load(file);
+    if (!content) {
+        corto_throw("failed to read '%s'", file);
+        goto error;
+    }
+
+    char *line = content, *next;
+    bool valid = false;
+    for (; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) {
+            *next = '\0';
+            next ++;
+        }
+
+        if (!line[0]) {
+            continue;
+        }
+
+        if (!valid) {
+            /* First line identifies format */
+            if (strcmp(line, BAKE_FINGERPRINTS_VERSION)) {
+                corto_trace("ignoring fingerprints with unknown format");
+                break;
+            }
+            valid = true;
+        } else {
+            char *id = strchr(line, ' ');
+            if (!id) {
+                /* Fingerprints that can't be read cause projects to build */
+                corto_warning("fingerprints in '%s' are corrupt, ignoring", file);
+                break;
+            }
+            *id = '\0';
+            id ++;
+            bake_fingerprints_get(fp, id)->stored = strtoull(line, NULL, 16);
+        }
+    }
+    free(content);
+
+    return fp;
+error:
+    bake_fingerprints_free(fp);
+    return NULL;
+}
+
+int16_t bake_fingerprints_save(
+    bake_fingerprints fp)
+{
+    char *tmp = corto_asprintf("%s.tmp", fp->file);
+    FILE *f = NULL;
+
+    /* Write to temporary file first, so an interrupted write never leaves
+     * a truncated file behind */
+    if (!(f = fopen(tmp, "w"))) {
+        corto_throw("failed to open '%s': %s", tmp, strerror(errno));
+        goto error;
+    }
+
+    fprintf(f, "%s\n", BAKE_FINGERPRINTS_VERSION);
+
+    corto_iter it = corto_rb_iter(fp->projects);
+    while (corto_iter_hasNext(&it)) {
+        bake_fingerprint *e = corto_iter_next(&it);
+
+        /* Keep fingerprints of projects that were not crawled this time */
+        uint64_t fingerprint = e->current ? e->current : e->stored;
+        if (fingerprint) {
+            fprintf(f, "%016" PRIx64 " %s\n", fingerprint, e->id);
+        }
+    }
+
+    if (fclose(f)) {
+        f = NULL;
+        corto_throw("failed to write '%s': %s", tmp, strerror(errno));
+        goto error;
+    }
+    f = NULL;
+
+    if (rename(tmp, fp->file)) {
+        corto_throw("failed to move '%s' to '%s': %s",
+            tmp, fp->file, strerror(errno));
+        goto error;
+    }
+
+    free(tmp);
+    return 0;
+error:
+    if (f) fclose(f);
+    unlink(tmp);
+    free(tmp);
+    return -1;
+}
+
+void bake_fingerprints_free(
+    bake_fingerprints fp)
+{
+    corto_iter it = corto_rb_iter(fp->projects);
+    while (corto_iter_hasNext(&it)) {
+        bake_fingerprint *e = corto_iter_next(&it);
+        free(e->id);
+        free(e);
+    }
+    corto_rb_free(fp->projects);
+    free(fp->file);
+    free(fp);
+}
+
+/* Hash name, timestamp and size of a file. Hashes of files are added up, so
+ * that the fingerprint does not depend on the order of directory entries. */
+static
+uint64_t bake_fingerprint_file(
+    const char *path,
+    struct stat *st)
+{
+    uint64_t timestamp = bake_mtime_stat(st);
+    uint64_t size = st->st_size;
+    uint64_t hash = bake_db_hash(0, path, strlen(path));
+    hash = bake_db_hash(hash, &timestamp, sizeof(timestamp));
+    return bake_db_hash(hash, &size, sizeof(size));
+}
+
+static
+uint64_t bake_fingerprint_dir(
+    const char *dir)
+{
+    uint64_t result = 0;
+    corto_iter it;
+
+    if (corto_dir_iter(dir, NULL, &it)) {
+        /* Directory can't be read, so its contents are unknown */
+        corto_catch();
+        return 0;
+    }
+
+    while (corto_iter_hasNext(&it)) {
+        char *file = corto_iter_next(&it);
+        char *path = corto_asprintf("%s/%s", dir, file);
+        struct stat st;
+
+        if (!stat(path, &st)) {
+            result += bake_fingerprint_file(path, &st);
+            if (S_ISDIR(st.st_mode)) {
+                result += bake_fingerprint_dir(path);
+            }
+        }
+        free(path);
+    }
+
+    return result;
+}
+
+static
+uint64_t bake_fingerprint_list(
+    bake_project *p,
+    corto_ll dirs)
+{
+    uint64_t result = 0;
+
+    corto_iter it = corto_ll_iter(dirs);
+    while (corto_iter_hasNext(&it)) {
+        char *path = bake_project_file(p, corto_iter_next(&it));
+        if (corto_isdir(path)) {
+            result += bake_fingerprint_dir(path);
+        }
+        free(path);
+    }
+
+    return result;
+}
+
+static
+uint64_t bake_fingerprint_str(
+    uint64_t hash,
+    const char *str)
+{
+    if (!str) {
+        str = "";
+    }
+    return bake_db_hash(hash, str, strlen(str) + 1);
+}
+
+/* Hash the settings of a configuration, as builds with different settings
+ * produce different artefacts */
+static
+uint64_t bake_fingerprint_config(
+    bake_config *c)
+{
+    uint64_t hash = bake_fingerprint_str(0, c->environment);
+    hash = bake_fingerprint_str(hash, c->id);
+    bool flags[] = {c->symbols, c->debug, c->optimizations, c->coverage, c->strict};
+    hash = bake_db_hash(hash, flags, sizeof(flags));
+
+    if (c->variables) {
+        corto_iter it = corto_ll_iter(c->variables);
+        while (corto_iter_hasNext(&it)) {
+            char *var = corto_iter_next(&it);
+            hash = bake_fingerprint_str(hash, var);
+            hash = bake_fingerprint_str(hash, corto_getenv(var));
+        }
+    }
+
+    return hash;
+}
+
+/* Fingerprint configuration, project.json, sources and includes of a project */
+static
+uint64_t bake_fingerprint_project(
+    bake_project *p)
+{
+    uint64_t result = bake_fingerprint_config(p->cfg);
+    struct stat st;
+
+    char *config = bake_project_file(p, "project.json");
+    if (!stat(config, &st)) {
+        result += bake_fingerprint_file(config, &st);
+    }
+    free(config);
+
+    result += bake_fingerprint_list(p, p->sources);
+    result += bake_fingerprint_list(p, p->includes);
+
+    /* 0 indicates a missing fingerprint */
+    return result ? result : 1;
+}
+
+static
+bake_fingerprint* bake_fingerprints_find_project(
+    bake_fingerprints fp,
+    bake_project *p)
+{
+    char *id = corto_asprintf("%s:%s:%s",
+        p->cfg->environment, p->cfg->id, p->id);
+    bake_fingerprint *e = bake_fingerprints_get(fp, id);
+    free(id);
+    return e;
+}
+
+bool bake_fingerprints_changed(
+    bake_fingerprints fp,
+    bake_project *p)
+{
+    bake_fingerprint *e = bake_fingerprints_find_project(fp, p);
+    return bake_fingerprint_project(p) != e->stored;
+}
+
+void bake_fingerprints_store(
+    bake_fingerprints fp,
+    bake_project *p)
+{
+    bake_fingerprint *e = bake_fingerprints_find_project(fp, p);
+    e->current = bake_fingerprint_project(p);
+}
+
+void bake_fingerprints_forget(
+    bake_fingerprints fp,
+    bake_project *p)
+{
+    bake_fingerprint *e = bake_fingerprints_find_project(fp, p);
+    e->current = 0;
+    e->stored = 0;
+}
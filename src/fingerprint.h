@@ -0,0 +1,90 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section fingerprint Fingerprint API
+ * @brief Detects which projects changed since a previous build.
+ *
+ * The fingerprint of a project is a hash of the build configuration, and of
+ * the names, timestamps and sizes of its project.json and the files in its
+ * source and include directories. Fingerprints are stored in a state file per
+ * project and configuration, so that a later build can skip the projects of
+ * which the fingerprint did not change.
+ */
+
+typedef struct bake_fingerprints_s* bake_fingerprints;
+
+/** Load fingerprints from a state file.
+ * If the file does not exist, no fingerprints are loaded, and all projects
+ * are reported as changed.
+ *
+ * @param file Path to the state file.
+ * @return The fingerprints, or NULL if failed.
+ */
+bake_fingerprints bake_fingerprints_load(
+    const char *file);
+
+/** Write fingerprints to the state file they were loaded from.
+ *
+ * @param fp The fingerprints.
+ * @return 0 if success, non-zero if failed.
+ */
+int16_t bake_fingerprints_save(
+    bake_fingerprints fp);
+
+/** Free fingerprints.
+ *
+ * @param fp The fingerprints.
+ */
+void bake_fingerprints_free(
+    bake_fingerprints fp);
+
+/** Test whether a project changed since its fingerprint was stored.
+ *
+ * @param fp The fingerprints.
+ * @param p The project.
+ * @return true if the project changed or has no stored fingerprint.
+ */
+bool bake_fingerprints_changed(
+    bake_fingerprints fp,
+    bake_project *p);
+
+/** Compute and store the current fingerprint of a project.
+ * The fingerprint is written to the state file on the next call to
+ * bake_fingerprints_save.
+ *
+ * @param fp The fingerprints.
+ * @param p The project.
+ */
+void bake_fingerprints_store(
+    bake_fingerprints fp,
+    bake_project *p);
+
+/** Remove the fingerprint of a project.
+ * This is used when the artefacts of a project are removed, so that the next
+ * build builds the project.
+ *
+ * @param fp The fingerprints.
+ * @param p The project.
+ */
+void bake_fingerprints_forget(
+    bake_fingerprints fp,
+    bake_project *p);
@@ -19,29 +19,120 @@
  * THE SOFTWARE.
  */
 
+#ifdef __linux__
+/* Required for copy_file_range */
+#define _GNU_SOURCE
+#endif
+
 #include "bake.h"
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
+/* Kinds of files in the install manifest */
+#define BAKE_INSTALL_LINK 'l' /* symbolic link to file in project */
+#define BAKE_INSTALL_COPY 'c' /* copy of file in project */
+#define BAKE_INSTALL_WRITE 'w' /* file with generated content */
+
+/* Manifest of installed files, stored in the project directory */
+#define BAKE_MANIFEST_FILE "uninstaller.bin"
+#define BAKE_MANIFEST_MAGIC (0x6d6b6162) /* "bakm" */
+#define BAKE_MANIFEST_VERSION (1)
+
+/* File installed to the package hierarchy. The hash identifies what was
+ * installed (the link target, or the file contents), so that files that did
+ * not change are not installed again. */
+typedef struct bake_install_entry {
+    char *dst;
+    char kind;
+    char *src; /* link target, file to copy, or content to write */
+    uint64_t hash;
+} bake_install_entry;
+
+static
+int bake_install_cmp(void *ctx, const void* key1, const void* key2) {
+    return strcmp(key1, key2);
+}
+
+static
+void bake_install_entry_free(
+    bake_install_entry *e)
+{
+    free(e->dst);
+    if (e->src) free(e->src);
+    free(e);
+}
+
+static
+void bake_manifest_free(
+    corto_rb manifest)
+{
+    corto_iter it = corto_rb_iter(manifest);
+    while (corto_iter_hasNext(&it)) {
+        bake_install_entry_free(corto_iter_next(&it));
+    }
+    corto_rb_free(manifest);
+}
+
+/* Add file to manifest. If a file is installed more than once, the last one
+ * wins, as it would overwrite the others. */
+static
+void bake_manifest_add(
+    corto_rb manifest,
+    const char *dst,
+    char kind,
+    const char *src,
+    uint64_t hash)
+{
+    bake_install_entry *e = corto_rb_find(manifest, dst);
+    if (!e) {
+        e = corto_calloc(sizeof(bake_install_entry));
+        e->dst = corto_strdup(dst);
+        corto_rb_set(manifest, e->dst, e);
+    } else if (e->src) {
+        free(e->src);
+    }
+
+    e->kind = kind;
+    e->src = src ? corto_strdup(src) : NULL;
+    e->hash = hash;
+}
+
+static
+uint64_t bake_install_hash_file(
+    const char *file)
+{
+    char *content = corto_file_load(file);
+    if (!content) {
+        corto_catch();
+        return 0;
+    }
+
+    uint64_t result = bake_db_hash(0, content, strlen(content));
+    free(content);
+    return result;
+}
 
 static
 int16_t bake_install_dir(
     char *id,
     char *dir,
-    char *subdir,
-    bool softlink,
-    FILE *uninstallFile)
+    char *source,
+    corto_rb manifest)
 {
-    corto_dirstack stack = NULL;
     corto_iter it;
 
-    char *source;
-    if (!subdir) {
-        source = strdup(dir);
-    } else {
-        source = strdup(subdir);
-    }
-
     /* If source path does not exist, nothing needs to be copied. */
     if (!corto_file_test(source)) {
-        free(source);
         return 0;
     }
 
@@ -61,33 +152,34 @@ int16_t bake_install_dir(
         }
     }
 
-    if (!(stack = corto_dirstack_push(stack, source))) goto error;
-
-    if (corto_dir_iter(".", NULL, &it)) goto error;
+    if (corto_dir_iter(source, NULL, &it)) goto error;
 
     while (corto_iter_hasNext(&it)) {
         char *file = corto_iter_next(&it);
+        char *src = corto_asprintf("%s/%s", source, file);
 
-        if (corto_isdir(file)) {
+        if (corto_isdir(src)) {
             if (!strnicmp(file, strlen("linux-"), "linux-") ||
                 !strnicmp(file, strlen("darwin-"), "darwin-") ||
                 !strnicmp(file, strlen("windows-"), "windows-"))
             {
                 if (corto_os_match(file)) {
-                    if (bake_install_dir(id, dir, file, softlink, uninstallFile)) {
+                    if (bake_install_dir(id, dir, src, manifest)) {
                         goto error;
                     }
                 } else {
                     /* If directory contains platform-specific content but does not
                      * match current platform, skip */
                 }
+                free(src);
                 continue;
             } else if (!stricmp(file, "everywhere"))
             {
                 /* Always copy all contents in everywhere */
-                if (bake_install_dir(id, dir, file, softlink, uninstallFile)) {
+                if (bake_install_dir(id, dir, src, manifest)) {
                     goto error;
                 }
+                free(src);
                 continue;
             }
         }
@@ -96,27 +188,36 @@ int16_t bake_install_dir(
         char *dst = corto_asprintf("%s/%s", target, file);
         corto_path_clean(dst, dst);
 
-        /* Copy file to target */
-        if (softlink) {
-            if (corto_symlink(file, dst)) goto error;
-        } else {
-            if (corto_cp(file, dst)) goto error;
-        }
+        /* Link file to target */
+        bake_manifest_add(manifest, dst, BAKE_INSTALL_LINK, src,
+            bake_db_hash(0, src, strlen(src)));
 
-        fprintf(uninstallFile, "%s\n", dst);
         free(dst);
+        free(src);
     }
 
-    if (corto_dirstack_pop(stack)) goto error;
-
     free(target);
-    free(source);
 
     return 0;
 error:
     return -1;
 }
 
+/* Install directory in project to package hierarchy */
+static
+int16_t bake_install_projectDir(
+    bake_project *project,
+    char *id,
+    char *dir,
+    const char *subdir,
+    corto_rb manifest)
+{
+    char *source = bake_project_file(project, subdir);
+    int16_t result = bake_install_dir(id, dir, source, manifest);
+    free(source);
+    return result;
+}
+
 static
 char* bake_uninstaller_filename(
     bake_project *project)
@@ -127,89 +228,856 @@ char* bake_uninstaller_filename(
 }
 
 static
-FILE* bake_uninstaller_open(
+char* bake_manifest_filename(
+    bake_project *project)
+{
+    return corto_envparse(
+        "$BAKE_TARGET/lib/corto/$BAKE_VERSION/%s/" BAKE_MANIFEST_FILE,
+        project->id);
+}
+
+/* Lines in the uninstaller start with the path of an installed file, which can
+ * be followed by a tab, the kind and the hash of the file. Uninstallers written
+ * by older versions only contain paths. */
+static
+void bake_uninstaller_parse(
+    char *line,
+    char **dst_out,
+    char *kind_out,
+    uint64_t *hash_out)
+{
+    char *tab = strchr(line, '\t');
+    *kind_out = 0;
+    *hash_out = 0;
+
+    if (tab) {
+        *tab = '\0';
+        if (tab[1]) {
+            *kind_out = tab[1];
+            *hash_out = strtoull(&tab[2], NULL, 16);
+        }
+    }
+
+    *dst_out = line;
+}
+
+#ifdef __linux__
+/* Copy contents of file. Data is copied by the kernel when possible, so that
+ * it does not pass through userspace. */
+static
+int16_t bake_install_copy_fd(
+    int src_fd,
+    int dst_fd,
+    off_t size)
+{
+    off_t copied = 0;
+    while (copied < size) {
+        ssize_t n = copy_file_range(
+            src_fd, NULL, dst_fd, NULL, size - copied, 0);
+        if (n <= 0) {
+            break;
+        }
+        copied += n;
+    }
+
+    if (copied == size) {
+        return 0;
+    }
+
+    /* Continue with read/write where copy_file_range stopped (for example
+     * when copying between filesystems on older kernels) */
+    char buf[65536];
+    while (true) {
+        ssize_t n = pread(src_fd, buf, sizeof(buf), copied);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (!n) {
+            break;
+        }
+
+        ssize_t written = 0;
+        while (written < n) {
+            ssize_t w = pwrite(dst_fd, buf + written, n - written, copied + written);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            written += w;
+        }
+        copied += n;
+    }
+
+    return 0;
+}
+#endif
+
+/* Copy file to a destination that does not exist yet. On Linux the file is
+ * cloned or copied in the kernel when possible. When that is not supported
+ * and allow_link is true, the file is hardlinked if the source is on the same
+ * filesystem. A hardlink shares the file with the project, so it is only
+ * allowed for files that bake never rewrites. */
+static
+int16_t bake_install_copy(
+    const char *src,
+    const char *dst,
+    bool allow_link)
+{
+#ifdef __linux__
+    struct stat st;
+    int src_fd = -1, dst_fd = -1;
+
+    if ((src_fd = open(src, O_RDONLY | O_CLOEXEC)) == -1) {
+        corto_throw("failed to open '%s': %s", src, strerror(errno));
+        goto error;
+    }
+
+    if (fstat(src_fd, &st)) {
+        corto_throw("failed to stat '%s': %s", src, strerror(errno));
+        goto error;
+    }
+
+    dst_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+        st.st_mode & 07777);
+    if (dst_fd == -1) {
+        corto_throw("failed to create '%s': %s", dst, strerror(errno));
+        goto error;
+    }
+
+    /* On filesystems that support it (btrfs, xfs) the file is cloned, which
+     * shares data between the files until one of them is modified */
+    if (!ioctl(dst_fd, FICLONE, src_fd)) {
+        goto copied;
+    }
+
+    /* If neither cloning nor copy_file_range are supported, a hardlink still
+     * avoids duplicating the data */
+    if (allow_link &&
+        copy_file_range(src_fd, NULL, dst_fd, NULL, 0, 0) == -1 &&
+        (errno == ENOSYS || errno == EOPNOTSUPP))
+    {
+        close(dst_fd);
+        dst_fd = -1;
+        unlink(dst);
+        if (!link(src, dst)) {
+            /* The link is the source file, so it already has its mode */
+            goto done;
+        }
+
+        dst_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+            st.st_mode & 07777);
+        if (dst_fd == -1) {
+            corto_throw("failed to create '%s': %s", dst, strerror(errno));
+            goto error;
+        }
+    }
+
+    if (bake_install_copy_fd(src_fd, dst_fd, st.st_size)) {
+        corto_throw("failed to copy '%s' to '%s': %s",
+            src, dst, strerror(errno));
+        goto error;
+    }
+
+copied:
+    /* Mode is not applied to new files when it is masked by umask */
+    if (fchmod(dst_fd, st.st_mode & 07777)) {
+        corto_throw("failed to set permissions of '%s': %s",
+            dst, strerror(errno));
+        goto error;
+    }
+
+done:
+    if (dst_fd != -1 && close(dst_fd)) {
+        dst_fd = -1;
+        corto_throw("failed to write '%s': %s", dst, strerror(errno));
+        goto error;
+    }
+    close(src_fd);
+    return 0;
+error:
+    if (dst_fd != -1) close(dst_fd);
+    if (src_fd != -1) close(src_fd);
+    return -1;
+#else
+    return corto_cp(src, dst);
+#endif
+}
+
+static int bake_install_tmp_count = 0;
+
+/* Name of file in which a file is staged before it is published. The name is
+ * unique, so that processes and threads can stage files at the same time. */
+static
+char* bake_install_tmpname(
+    const char *dst)
+{
+    return corto_asprintf("%s.bake-%d-%d",
+        dst, (int)getpid(), corto_ainc(&bake_install_tmp_count));
+}
+
+/* Publish staged file. Rename replaces the previous file atomically, so that
+ * readers either see the previous or the new file, never a partial one. */
+static
+int16_t bake_install_publish(
+    const char *tmp,
+    const char *dst)
+{
+    if (rename(tmp, dst)) {
+        /* Files can't replace directories, which older versions could
+         * install. Remove the directory, and try again. */
+        if (errno != EISDIR && errno != ENOTEMPTY && errno != EEXIST) {
+            corto_throw("failed to move '%s' to '%s': %s",
+                tmp, dst, strerror(errno));
+            goto error;
+        }
+        if (corto_rm(dst) || rename(tmp, dst)) {
+            corto_throw("failed to move '%s' to '%s': %s",
+                tmp, dst, strerror(errno));
+            goto error;
+        }
+    }
+
+    return 0;
+error:
+    unlink(tmp);
+    return -1;
+}
+
+/* Files in the manifest, grouped by the directory they are installed to */
+typedef struct bake_manifest_dir {
+    char *path;
+    corto_ll entries; /* bake_install_entry, owned by manifest */
+} bake_manifest_dir;
+
+/* Group files in manifest by directory. Directories and the files in them are
+ * ordered by name, since the manifest is ordered by path. */
+static
+corto_rb bake_manifest_dirs(
+    corto_rb manifest)
+{
+    corto_rb result = corto_rb_new(bake_install_cmp, NULL);
+
+    corto_iter it = corto_rb_iter(manifest);
+    while (corto_iter_hasNext(&it)) {
+        bake_install_entry *e = corto_iter_next(&it);
+        char *last = strrchr(e->dst, '/');
+        if (!last || last == e->dst) {
+            continue;
+        }
+
+        char *path = corto_strdup(e->dst);
+        path[last - e->dst] = '\0';
+
+        bake_manifest_dir *d = corto_rb_find(result, path);
+        if (!d) {
+            d = corto_alloc(sizeof(bake_manifest_dir));
+            d->path = path;
+            d->entries = corto_ll_new();
+            corto_rb_set(result, d->path, d);
+        } else {
+            free(path);
+        }
+
+        corto_ll_append(d->entries, e);
+    }
+
+    return result;
+}
+
+static
+void bake_manifest_dirs_free(
+    corto_rb dirs)
+{
+    corto_iter it = corto_rb_iter(dirs);
+    while (corto_iter_hasNext(&it)) {
+        bake_manifest_dir *d = corto_iter_next(&it);
+        corto_ll_free(d->entries);
+        free(d->path);
+        free(d);
+    }
+    corto_rb_free(dirs);
+}
+
+/* Cursor for reading a binary manifest */
+typedef struct bake_manifest_reader {
+    const char *ptr;
+    const char *end;
+} bake_manifest_reader;
+
+static
+bool bake_manifest_read(
+    bake_manifest_reader *r,
+    void *out,
+    size_t size)
+{
+    if ((size_t)(r->end - r->ptr) < size) {
+        return false;
+    }
+    memcpy(out, r->ptr, size);
+    r->ptr += size;
+    return true;
+}
+
+static
+char* bake_manifest_readString(
+    bake_manifest_reader *r)
+{
+    uint32_t length;
+    if (!bake_manifest_read(r, &length, sizeof(length))) {
+        return NULL;
+    }
+    if ((size_t)(r->end - r->ptr) < length) {
+        return NULL;
+    }
+
+    char *result = malloc(length + 1);
+    memcpy(result, r->ptr, length);
+    result[length] = '\0';
+    r->ptr += length;
+    return result;
+}
+
+/* Parse binary manifest. The manifest starts with a header, followed by the
+ * directories, each with the names, kinds and hashes of its files. */
+static
+int16_t bake_manifest_parse(
+    corto_rb manifest,
+    const char *data,
+    size_t size)
+{
+    bake_manifest_reader r = {data, data + size};
+    uint32_t magic, version, dir_count, i;
+    char *dir = NULL, *name = NULL;
+
+    if (!bake_manifest_read(&r, &magic, sizeof(magic)) ||
+        !bake_manifest_read(&r, &version, sizeof(version)) ||
+        magic != BAKE_MANIFEST_MAGIC ||
+        version != BAKE_MANIFEST_VERSION)
+    {
+        goto error;
+    }
+
+    if (!bake_manifest_read(&r, &dir_count, sizeof(dir_count))) {
+        goto error;
+    }
+
+    for (i = 0; i < dir_count; i ++) {
+        uint32_t entry_count, j;
+        if (!(dir = bake_manifest_readString(&r))) {
+            goto error;
+        }
+        if (!bake_manifest_read(&r, &entry_count, sizeof(entry_count))) {
+            goto error;
+        }
+
+        for (j = 0; j < entry_count; j ++) {
+            char kind;
+            uint64_t hash;
+            if (!bake_manifest_read(&r, &kind, sizeof(kind)) ||
+                !bake_manifest_read(&r, &hash, sizeof(hash)) ||
+                !(name = bake_manifest_readString(&r)))
+            {
+                goto error;
+            }
+
+            char *dst = corto_asprintf("%s/%s", dir, name);
+            bake_manifest_add(manifest, dst, kind, NULL, hash);
+            free(dst);
+            free(name);
+            name = NULL;
+        }
+
+        free(dir);
+        dir = NULL;
+    }
+
+    return 0;
+error:
+    if (dir) free(dir);
+    if (name) free(name);
+    return -1;
+}
+
+/* Load uninstaller written by older versions, with a path on each line */
+static
+int16_t bake_manifest_loadLegacy(
+    corto_rb manifest,
+    const char *filename)
+{
+    corto_iter it;
+
+    if (corto_file_iter((char*)filename, &it)) {
+        goto error;
+    }
+
+    while (corto_iter_hasNext(&it)) {
+        char *line = corto_iter_next(&it);
+        if (!line || !line[0]) continue; /* Skip empty lines in file */
+        if (line[0] == '/') {
+            char *dst, kind;
+            uint64_t hash;
+            bake_uninstaller_parse(line, &dst, &kind, &hash);
+            bake_manifest_add(manifest, dst, kind, NULL, hash);
+        } else {
+            corto_warning(
+                "ignoring '%s' in uninstaller.txt, path should be absolute",
+                line);
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Load manifest of files installed by previous build. If the binary manifest
+ * does not exist, the uninstaller of older versions is loaded instead. */
+static
+corto_rb bake_manifest_load(
+    bake_project *project,
+    bool *found_out)
+{
+    corto_rb result = corto_rb_new(bake_install_cmp, NULL);
+    char *filename = bake_manifest_filename(project);
+    char *data = NULL;
+    FILE *f = NULL;
+    bool found = false;
+
+    if ((f = fopen(filename, "rb"))) {
+        long size;
+        if (!fseek(f, 0, SEEK_END) && (size = ftell(f)) >= 0 &&
+            !fseek(f, 0, SEEK_SET))
+        {
+            data = malloc(size ? size : 1);
+            if (fread(data, 1, size, f) == (size_t)size &&
+                !bake_manifest_parse(result, data, size))
+            {
+                found = true;
+            }
+        }
+        fclose(f);
+        free(data);
+
+        if (!found) {
+            /* Without manifest all files are installed again */
+            corto_warning("install manifest '%s' is corrupt, ignoring", filename);
+            bake_manifest_free(result);
+            result = corto_rb_new(bake_install_cmp, NULL);
+        }
+    } else {
+        char *legacy = bake_uninstaller_filename(project);
+        if (corto_file_test(legacy) == 1) {
+            if (bake_manifest_loadLegacy(result, legacy)) {
+                corto_catch();
+            } else {
+                found = true;
+            }
+        }
+        free(legacy);
+    }
+
+    if (found_out) {
+        *found_out = found;
+    }
+
+    free(filename);
+    return result;
+}
+
+static
+void bake_manifest_write(
+    FILE *f,
+    const void *data,
+    size_t size)
+{
+    fwrite(data, 1, size, f);
+}
+
+static
+void bake_manifest_writeString(
+    FILE *f,
+    const char *str)
+{
+    uint32_t length = strlen(str);
+    bake_manifest_write(f, &length, sizeof(length));
+    bake_manifest_write(f, str, length);
+}
+
+static
+int16_t bake_manifest_save(
     bake_project *project,
-    const char *mode)
+    corto_rb manifest)
 {
-    char *filename = bake_uninstaller_filename(project);
-    FILE *result = corto_file_open(filename, mode);
+    char *filename = bake_manifest_filename(project);
+    char *tmp = bake_install_tmpname(filename);
+    corto_rb dirs = bake_manifest_dirs(manifest);
+    FILE *f = corto_file_open(tmp, "wb");
+    if (!f) {
+        corto_throw("failed to open '%s'", tmp);
+        goto error;
+    }
+
+    uint32_t magic = BAKE_MANIFEST_MAGIC, version = BAKE_MANIFEST_VERSION;
+    uint32_t dir_count = corto_rb_count(dirs);
+    bake_manifest_write(f, &magic, sizeof(magic));
+    bake_manifest_write(f, &version, sizeof(version));
+    bake_manifest_write(f, &dir_count, sizeof(dir_count));
+
+    corto_iter it = corto_rb_iter(dirs);
+    while (corto_iter_hasNext(&it)) {
+        bake_manifest_dir *d = corto_iter_next(&it);
+        uint32_t entry_count = corto_ll_count(d->entries);
+        bake_manifest_writeString(f, d->path);
+        bake_manifest_write(f, &entry_count, sizeof(entry_count));
+
+        corto_iter entry_it = corto_ll_iter(d->entries);
+        while (corto_iter_hasNext(&entry_it)) {
+            bake_install_entry *e = corto_iter_next(&entry_it);
+            bake_manifest_write(f, &e->kind, sizeof(e->kind));
+            bake_manifest_write(f, &e->hash, sizeof(e->hash));
+            bake_manifest_writeString(f, strrchr(e->dst, '/') + 1);
+        }
+    }
+
+    bool failed = ferror(f);
+    if (fclose(f) || failed) {
+        corto_throw("failed to write '%s': %s", tmp, strerror(errno));
+        unlink(tmp);
+        goto error;
+    }
+
+    if (bake_install_publish(tmp, filename)) {
+        goto error;
+    }
+
+    /* Remove uninstaller of older versions, now that manifest replaces it */
+    char *legacy = bake_uninstaller_filename(project);
+    unlink(legacy);
+    free(legacy);
+
+    bake_manifest_dirs_free(dirs);
+    free(tmp);
+    free(filename);
+    return 0;
+error:
+    bake_manifest_dirs_free(dirs);
+    free(tmp);
     free(filename);
+    return -1;
+}
+
+/* Install a single file to the package hierarchy. The file is staged next to
+ * its destination, and then published by renaming it. */
+static
+int16_t bake_install_file(
+    bake_install_entry *e)
+{
+    struct stat st;
+    char *tmp = NULL;
+
+    if (lstat(e->dst, &st)) {
+        char *dir = corto_strdup(e->dst);
+        char *last = strrchr(dir, '/');
+        if (last && last != dir) {
+            *last = '\0';
+            if (corto_mkdir(dir)) {
+                free(dir);
+                goto error;
+            }
+        }
+        free(dir);
+    }
+
+    tmp = bake_install_tmpname(e->dst);
 
+    if (e->kind == BAKE_INSTALL_LINK) {
+        if (corto_symlink(e->src, tmp)) {
+            goto error;
+        }
+    } else if (e->kind == BAKE_INSTALL_COPY) {
+        /* Files are copied from the project, which bake does not write */
+        if (bake_install_copy(e->src, tmp, true)) {
+            goto error;
+        }
+    } else {
+        FILE *f = fopen(tmp, "w");
+        if (!f) {
+            corto_throw("failed to write to '%s': %s", tmp, strerror(errno));
+            goto error;
+        }
+        fprintf(f, "%s\n", e->src);
+        if (fclose(f)) {
+            corto_throw("failed to write to '%s': %s", tmp, strerror(errno));
+            goto error;
+        }
+    }
+
+    /* Staged file is removed by publish if it fails */
+    int16_t result = bake_install_publish(tmp, e->dst);
+    free(tmp);
     return result;
+error:
+    if (tmp) {
+        unlink(tmp);
+        free(tmp);
+    }
+    return -1;
+}
+
+/* Bring package hierarchy in sync with manifest. Only files that are not in
+ * the previous manifest, that changed or that went missing are installed, and
+ * only files that are no longer in the manifest are removed. */
+static
+int16_t bake_install_sync(
+    bake_project *project,
+    corto_rb manifest)
+{
+    corto_rb installed = bake_manifest_load(project, NULL);
+    bool changed = false;
+    struct stat st;
+
+    corto_iter it = corto_rb_iter(manifest);
+    while (corto_iter_hasNext(&it)) {
+        bake_install_entry *e = corto_iter_next(&it);
+        bake_install_entry *prev = corto_rb_find(installed, e->dst);
+        if (prev && prev->kind == e->kind && prev->hash == e->hash &&
+            !lstat(e->dst, &st))
+        {
+            continue;
+        }
+
+        if (bake_install_file(e)) {
+            goto error;
+        }
+        changed = true;
+    }
+
+    /* Remove files after new files are published, so that readers never see
+     * a package without files */
+    it = corto_rb_iter(installed);
+    while (corto_iter_hasNext(&it)) {
+        bake_install_entry *e = corto_iter_next(&it);
+        if (!corto_rb_find(manifest, e->dst)) {
+            if (corto_rm(e->dst)) {
+                corto_warning("failed to uninstall '%s' for '%s'",
+                    e->dst,
+                    project->id);
+            }
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        if (bake_manifest_save(project, manifest)) {
+            goto error;
+        }
+        corto_trace("updated files in package hierarchy");
+    } else {
+        corto_trace("package hierarchy is up to date");
+    }
+
+    bake_manifest_free(installed);
+    return 0;
+error:
+    bake_manifest_free(installed);
+    return -1;
+}
+
+/* Remove files installed to a directory. Files are removed relative to the
+ * directory, so that the path is only resolved once per directory. */
+static
+int16_t bake_uninstall_dir(
+    void *job,
+    void *ctx)
+{
+    bake_manifest_dir *d = job;
+    bake_project *project = ctx;
+    corto_iter it = corto_ll_iter(d->entries);
+
+#ifdef __linux__
+    int fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        /* If directory does not exist, neither do its files */
+        return 0;
+    }
+
+    while (corto_iter_hasNext(&it)) {
+        bake_install_entry *e = corto_iter_next(&it);
+        if (unlinkat(fd, strrchr(e->dst, '/') + 1, 0)) {
+            if (errno == ENOENT) {
+                continue;
+            }
+            /* Older versions could install directories */
+            if (errno == EISDIR && !corto_rm(e->dst)) {
+                continue;
+            }
+            corto_warning("failed to uninstall '%s' for '%s'",
+                e->dst,
+                project->id);
+        }
+    }
+
+    close(fd);
+#else
+    while (corto_iter_hasNext(&it)) {
+        bake_install_entry *e = corto_iter_next(&it);
+        if (corto_rm(e->dst)) {
+            corto_warning("failed to uninstall '%s' for '%s'",
+                e->dst,
+                project->id);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+static
+void bake_uninstall_addDir(
+    corto_rb set,
+    const char *dir)
+{
+    if (!corto_rb_find(set, dir)) {
+        char *key = corto_strdup(dir);
+        corto_rb_set(set, key, key);
+    }
+}
+
+/* Remove directories of a project that are empty after uninstalling. The
+ * project directories in lib, include and etc are pruned, together with the
+ * directories in them that contained installed files. Directories are removed
+ * in reverse order, so that subdirectories are removed before their parents,
+ * and a parent becomes empty before it is visited. */
+static
+void bake_uninstall_prune(
+    corto_rb dirs,
+    char **roots,
+    int root_count)
+{
+    corto_rb set = corto_rb_new(bake_install_cmp, NULL);
+    int i;
+
+    for (i = 0; i < root_count; i ++) {
+        bake_uninstall_addDir(set, roots[i]);
+    }
+
+    corto_iter it = corto_rb_iter(dirs);
+    while (corto_iter_hasNext(&it)) {
+        bake_manifest_dir *d = corto_iter_next(&it);
+        for (i = 0; i < root_count; i ++) {
+            size_t len = strlen(roots[i]);
+            if (strncmp(d->path, roots[i], len) || d->path[len] != '/') {
+                continue;
+            }
+
+            /* Add directory, and its parents up to the project directory */
+            char *dir = corto_strdup(d->path);
+            while (strlen(dir) > len) {
+                bake_uninstall_addDir(set, dir);
+                *strrchr(dir, '/') = '\0';
+            }
+            free(dir);
+        }
+    }
+
+    corto_ll ordered = corto_ll_new();
+    it = corto_rb_iter(set);
+    while (corto_iter_hasNext(&it)) {
+        corto_ll_insert(ordered, corto_iter_next(&it));
+    }
+
+    /* Directories that are not empty (nested packages, installed binaries) or
+     * that don't exist are left alone */
+    it = corto_ll_iter(ordered);
+    while (corto_iter_hasNext(&it)) {
+        char *dir = corto_iter_next(&it);
+        rmdir(dir);
+        free(dir);
+    }
+
+    corto_ll_free(ordered);
+    corto_rb_free(set);
 }
 
 int16_t bake_uninstall(
     bake_project *project)
 {
-    corto_iter it;
+    char *roots[3] = {NULL};
+    corto_rb manifest = NULL, dirs = NULL;
+    int i;
 
     corto_log_push("uninstall");
     corto_trace("begin");
 
     if (project->kind != BAKE_TOOL) {
-        char *projectDir = corto_envparse(
+        /* Directories in package hierarchy that belong to the project */
+        roots[0] = corto_envparse(
             "$BAKE_TARGET/lib/corto/$BAKE_VERSION/%s", project->id);
-        if (!projectDir) {
+        roots[1] = corto_envparse(
+            "$BAKE_TARGET/include/corto/$BAKE_VERSION/%s", project->id);
+        roots[2] = corto_envparse(
+            "$BAKE_TARGET/etc/corto/$BAKE_VERSION/%s", project->id);
+        if (!roots[0] || !roots[1] || !roots[2]) {
             goto error;
         }
 
         /* Uninstall files are stored in the project directory, try uninstalling
-         * first by removing all files in uninstaller file. */
-        if (corto_file_test(projectDir)) {
-            char *filename = bake_uninstaller_filename(project);
-            if (corto_file_iter(filename, &it)) {
-                corto_catch(); /* Catch last error */
+         * first by removing all files in the manifest. */
+        if (corto_file_test(roots[0])) {
+            bool found;
+            manifest = bake_manifest_load(project, &found);
+            if (!found) {
                 corto_warning("missing uninstaller for project '%s'", project->id);
-                free(filename);
                 goto skip;
             }
 
+            /* Directories don't share files, so they are cleaned up in
+             * parallel */
+            dirs = bake_manifest_dirs(manifest);
+            corto_ll jobs = corto_ll_new();
+            corto_iter it = corto_rb_iter(dirs);
             while (corto_iter_hasNext(&it)) {
-                char *line = corto_iter_next(&it);
-                if (!line || !line[0]) continue; /* Skip empty lines in file */
-                if (line[0] == '/') {
-                    if (corto_rm(line)) {
-                        corto_warning("failed to uninstall '%s' for '%s'",
-                            line,
-                            project->id);
-                    }
-                } else {
-                    corto_warning(
-                        "ignoring '%s' in uninstaller.txt, path should be absolute",
-                        line);
-                }
+                corto_ll_append(jobs, corto_iter_next(&it));
             }
+            uint32_t threads = project->cfg && project->cfg->jobs
+                ? project->cfg->jobs
+                : 1;
+            bake_jobs_run(threads, jobs, bake_uninstall_dir, project);
+            corto_ll_free(jobs);
 
-            /* Remove uninstaller */
-            if (corto_rm(filename)) {
+            /* Remove manifest */
+            char *filename = bake_manifest_filename(project);
+            if (unlink(filename) && errno != ENOENT) {
                 corto_warning("failed to remove '%s'", filename);
             }
-
-            /* Free project directory if it's empty (no nested packages) */
-            if (corto_dir_isEmpty(projectDir)) corto_rm(projectDir);
-            free(projectDir);
+            free(filename);
+            filename = bake_uninstaller_filename(project);
+            if (unlink(filename) && errno != ENOENT) {
+                corto_warning("failed to remove '%s'", filename);
+            }
+            free(filename);
+        } else {
+            dirs = corto_rb_new(bake_install_cmp, NULL);
         }
 
-        /* In the case of an unsuccessful or interrupted uninstallation, some parts
-         * may be left behind. Check for lingering directories, and clean up. */
-
-        /* If include directory exists and is empty, clean up */
-        char *inc = corto_envparse(
-            "$BAKE_TARGET/include/corto/$BAKE_VERSION/%s", project->id);
-        if (corto_file_test(inc) && corto_dir_isEmpty(inc)) corto_rm(inc);
-        free(inc);
-
-        /* If etc directory exists and is empty, clean up */
-        char *etc = corto_envparse(
-            "$BAKE_TARGET/etc/corto/$BAKE_VERSION/%s", project->id);
-        if (corto_file_test(etc) && corto_dir_isEmpty(etc)) corto_rm(etc);
-        free(etc);
+        /* In the case of an unsuccessful or interrupted uninstallation, some
+         * parts may be left behind, which are cleaned up as well. */
+        bake_uninstall_prune(dirs, roots, 3);
     }
 
 skip:
+    if (dirs) bake_manifest_dirs_free(dirs);
+    if (manifest) bake_manifest_free(manifest);
+    for (i = 0; i < 3; i ++) {
+        if (roots[i]) free(roots[i]);
+    }
     corto_log_pop();
     return 0;
 error:
+    for (i = 0; i < 3; i ++) {
+        if (roots[i]) free(roots[i]);
+    }
     corto_log_pop();
     return -1;
 }
@@ -217,110 +1085,99 @@ error:
 int16_t bake_pre(
     bake_project *project)
 {
+    corto_rb manifest = NULL;
+
     corto_log_push("pre");
     corto_trace("begin");
 
     if (project->kind != BAKE_TOOL) {
-        FILE *uninstallFile = bake_uninstaller_open(project, "w");
-        if (!uninstallFile) {
-            goto error;
-        }
+        manifest = corto_rb_new(bake_install_cmp, NULL);
 
         /* Copy project.json and file that points back to source */
-        if (corto_file_test("project.json")) {
+        char *project_json = bake_project_file(project, "project.json");
+        if (corto_file_test(project_json)) {
             char *projectDir = corto_envparse(
                 "$BAKE_TARGET/lib/corto/$BAKE_VERSION/%s", project->id);
 
             /* Copy project file */
-            if (corto_cp("project.json", projectDir)) {
-                free(projectDir);
-                goto error;
-            }
+            char *dst = corto_asprintf("%s/project.json", projectDir);
+            bake_manifest_add(manifest, dst, BAKE_INSTALL_COPY, project_json,
+                bake_install_hash_file(project_json));
+            free(dst);
 
             /* Write project source location to package repository */
-            FILE *src_location = fopen(strarg("%s/source.txt", projectDir), "w");
-            if (!src_location) {
-                corto_throw("failed to write to '%s' for '%s'",
-                    strarg("%s/dependee.json", projectDir),
-                    project->id);
-                goto error;
-            }
-            fprintf(src_location, "%s\n", corto_cwd());
-            fclose(src_location);
+            dst = corto_asprintf("%s/source.txt", projectDir);
+            bake_manifest_add(manifest, dst, BAKE_INSTALL_WRITE, project->path,
+                bake_db_hash(0, project->path, strlen(project->path)));
+            free(dst);
 
             /* If project contains dependee JSON, write to dependee.json */
             if (project->dependee_json && strlen(project->dependee_json)) {
-                FILE *dependee_config =
-                    fopen(strarg("%s/dependee.json", projectDir), "w");
-                if (!dependee_config) {
-                    corto_throw("failed to write to '%s' for '%s'",
-                        strarg("%s/dependee.json", projectDir),
-                        project->id);
-                    goto error;
-                }
-                fprintf(dependee_config, "%s\n", project->dependee_json);
-                fclose(dependee_config);
-                fprintf(uninstallFile, "%s/dependee.json\n", projectDir);
+                dst = corto_asprintf("%s/dependee.json", projectDir);
+                bake_manifest_add(
+                    manifest,
+                    dst,
+                    BAKE_INSTALL_WRITE,
+                    project->dependee_json,
+                    bake_db_hash(0, project->dependee_json,
+                        strlen(project->dependee_json)));
+                free(dst);
             }
 
-            fprintf(uninstallFile, "%s/project.json\n", projectDir);
-            fprintf(uninstallFile, "%s/source.txt\n", projectDir);
-
             free(projectDir);
         }
+        free(project_json);
 
         /* Install files to project-specific locations in package hierarchy */
         if (project->public) {
             corto_iter it = corto_ll_iter(project->includes);
             while (corto_iter_hasNext(&it)) {
-                if (bake_install_dir(
+                if (bake_install_projectDir(
+                    project,
                     project->id,
                     "include",
                     corto_iter_next(&it),
-                    true,
-                    uninstallFile))
+                    manifest))
                 {
                     goto error;
                 }
             }
         }
-        if (bake_install_dir(project->id, "etc", NULL, true, uninstallFile)) {
+        if (bake_install_projectDir(project, project->id, "etc", "etc", manifest)) {
             goto error;
         }
         if (project->kind == BAKE_PACKAGE) {
-            if (bake_install_dir(project->id, "lib", NULL, true, uninstallFile)) {
+            if (bake_install_projectDir(project, project->id, "lib", "lib", manifest)) {
                 goto error;
             }
         }
 
         /* Install files to BAKE_TARGET directly from 'install' folder */
-        if (corto_file_test("install")) {
-            if (corto_chdir("install")) {
-                goto error;
-            }
-            if (bake_install_dir(NULL, "include", NULL, true, uninstallFile)) {
-                goto error;
-            }
-            if (bake_install_dir(NULL, "lib", NULL, true, uninstallFile)) {
-                goto error;
-            }
-            if (bake_install_dir(NULL, "etc", NULL, true, uninstallFile)) {
-                goto error;
-            }
-            if (bake_install_dir(NULL, "java", NULL, true, uninstallFile)) {
-                goto error;
-            }
-            if (corto_chdir("..")) {
-                goto error;
-            }
+        if (bake_install_projectDir(project, NULL, "include", "install/include", manifest)) {
+            goto error;
+        }
+        if (bake_install_projectDir(project, NULL, "lib", "install/lib", manifest)) {
+            goto error;
+        }
+        if (bake_install_projectDir(project, NULL, "etc", "install/etc", manifest)) {
+            goto error;
+        }
+        if (bake_install_projectDir(project, NULL, "java", "install/java", manifest)) {
+            goto error;
+        }
+
+        /* Only touch files that changed since the last install */
+        if (bake_install_sync(project, manifest)) {
+            goto error;
         }
 
-        fclose(uninstallFile);
+        bake_manifest_free(manifest);
     }
 
     corto_log_pop();
     return 0;
 error:
+    if (manifest) bake_manifest_free(manifest);
     corto_log_pop();
     return -1;
 }
@@ -340,16 +1197,18 @@ int16_t bake_post(
         goto error;
     }
 
-    char *artefact_full = corto_asprintf("bin/%s-%s/%s",
-        CORTO_PLATFORM_STRING, project->cfg->id, artefact);
+    char *artefact_full = corto_asprintf("%s/bin/%s-%s/%s",
+        project->path, CORTO_PLATFORM_STRING, project->cfg->id, artefact);
 
     if (!corto_file_test(artefact_full)) {
 
         /* If artefact cannot be found, try just the artefact name itself */
-        if (corto_file_test(artefact)) {
+        char *artefact_local = bake_project_file(project, artefact);
+        if (corto_file_test(artefact_local)) {
             free(artefact_full);
-            artefact_full = corto_strdup(artefact);
+            artefact_full = artefact_local;
         } else {
+            free(artefact_local);
             corto_throw("cannot find artefact '%s'", artefact_full);
             goto error;
         }
@@ -366,28 +1225,20 @@ int16_t bake_post(
 
     char *targetBinary = corto_asprintf("%s/%s", targetDir, artefact);
     if (!corto_file_test(targetBinary) || project->freshly_baked) {
-        /* Copy binary */
-        if (corto_cp(artefact_full, targetBinary)) {
+        /* Copy binary. The binary is staged first, so that processes that
+         * load it never see a partially written file. */
+        char *tmp = bake_install_tmpname(targetBinary);
+        /* The artefact is rewritten by the next build, so never link it */
+        if (bake_install_copy(artefact_full, tmp, false)) {
+            unlink(tmp);
+            free(tmp);
             goto error;
         }
-
-        /* Ensure that time on the local system has progressed past the point of the
-         * file timestamp. If the build is running in a VM, the clock between the
-         * client and host could be out of sync temporarily, which can result in
-         * strange behavior. */
-        char *installedArtefact = corto_asprintf("%s/%s", targetDir, artefact);
-        time_t t_artefact = corto_lastmodified(installedArtefact);
-        time_t t = time(NULL);
-        int i = 0;
-        while (t_artefact > time(NULL) && i < 10) {
-            corto_sleep(0, 100000000); /* sleep 100msec */
-            i ++;
-        }
-        if (i == 10) {
-            corto_warning(
-                "clock drift of >1sec between the OS clock and the filesystem detected");
+        if (bake_install_publish(tmp, targetBinary)) {
+            free(tmp);
+            goto error;
         }
-        free(installedArtefact);
+        free(tmp);
 
         corto_ok("installed '%s/%s'", targetDir, artefact);
     }
@@ -27,6 +27,9 @@
  */
 
 /** Copy static files to package hierarchy (pre build).
+ * The files are compared with the files recorded by the previous install.
+ * Only files that changed are installed, and files that are no longer part of
+ * the project are removed.
  *
  * @param id Project id.
  * @param projectPath Path to the project source directory.
@@ -46,6 +49,8 @@ int16_t bake_post(
     char *artefact);
 
 /** Remove files from package hierarchy for project.
+ * Files are removed per directory, in parallel. Project directories that are
+ * empty afterwards are removed as well.
  *
  * @param id Project id.
  * @return 0 if success, non-zero if failed.
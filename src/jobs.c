@@ -0,0 +1,387 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+#include <fcntl.h>
+#include <poll.h>
+
+/* Milliseconds between checks whether waiting for a token should be cancelled */
+#define BAKE_JOBSERVER_POLL_INTERVAL (100)
+
+/* Jobserver file descriptors (read, write). -1 if there is no jobserver. */
+static int bake_jobserver_fds[2] = {-1, -1};
+
+/* Nonblocking descriptor for reading tokens, so that waiting for a token can
+ * be cancelled. The read end shared with make processes must stay blocking,
+ * so this is a separately opened descriptor for the same pipe. Equal to the
+ * read end if the pipe could not be reopened. */
+static int bake_jobserver_poll_fd = -1;
+
+/* Is jobserver created by this process */
+static bool bake_jobserver_owned = false;
+
+typedef struct bake_jobs {
+    corto_ll jobs;
+    bake_job_cb action;
+    void *ctx;
+    bool failed;
+    struct corto_mutex_s lock;
+} bake_jobs;
+
+static
+bool bake_jobserver_valid(
+    int fd)
+{
+    return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+}
+
+/* Find jobserver in MAKEFLAGS of parent make process */
+static
+bool bake_jobserver_join(void)
+{
+    const char *makeflags = corto_getenv("MAKEFLAGS");
+    if (!makeflags) {
+        return false;
+    }
+
+    const char *auth = strstr(makeflags, "--jobserver-auth=");
+    if (auth) {
+        auth += strlen("--jobserver-auth=");
+    } else if ((auth = strstr(makeflags, "--jobserver-fds="))) {
+        auth += strlen("--jobserver-fds=");
+    } else {
+        return false;
+    }
+
+    if (!strncmp(auth, "fifo:", strlen("fifo:"))) {
+        /* Named pipe (GNU make 4.4 and newer) */
+        char *path = corto_strdup(auth + strlen("fifo:"));
+        char *end = strchr(path, ' ');
+        if (end) *end = '\0';
+        int fd = open(path, O_RDWR);
+        free(path);
+        if (fd < 0) {
+            return false;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        bake_jobserver_fds[0] = bake_jobserver_fds[1] = fd;
+        bake_jobserver_owned = true;
+    } else {
+        int r, w;
+        if (sscanf(auth, "%d,%d", &r, &w) != 2) {
+            return false;
+        }
+
+        /* Make closes the descriptors for commands that are not recursive make
+         * invocations while MAKEFLAGS is still set, so verify they're valid */
+        if (!bake_jobserver_valid(r) || !bake_jobserver_valid(w)) {
+            corto_trace("jobserver in MAKEFLAGS is not accessible, ignoring");
+            return false;
+        }
+        bake_jobserver_fds[0] = r;
+        bake_jobserver_fds[1] = w;
+    }
+
+    return true;
+}
+
+/* Open a nonblocking descriptor for the read end of the jobserver. Opening
+ * the pipe through /proc creates a new open file description, so setting
+ * O_NONBLOCK on it does not change the descriptor make processes read from. */
+static
+void bake_jobserver_open_poll(void)
+{
+    char path[64];
+    sprintf(path, "/proc/self/fd/%d", bake_jobserver_fds[0]);
+
+    int fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd != -1) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        bake_jobserver_poll_fd = fd;
+    } else {
+        /* Reads may block until a token is available, which delays cancelling
+         * until another process returns a token */
+        corto_trace("cannot reopen jobserver pipe, reads will block");
+        bake_jobserver_poll_fd = bake_jobserver_fds[0];
+    }
+}
+
+uint32_t bake_jobserver_init(
+    uint32_t jobs)
+{
+    if (bake_jobserver_join()) {
+        corto_trace("joining jobserver of parent process");
+        bake_jobserver_open_poll();
+
+        /* Number of jobs is bounded by tokens. Without an explicit number of
+         * jobs, use enough threads to keep all cores busy */
+        if (!jobs) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            jobs = cpus > 0 ? cpus : 1;
+        }
+        return jobs;
+    }
+
+    if (!jobs) {
+        jobs = 1;
+    }
+
+    if (jobs > 1) {
+        if (pipe(bake_jobserver_fds)) {
+            corto_warning("failed to create jobserver: %s", strerror(errno));
+            bake_jobserver_fds[0] = bake_jobserver_fds[1] = -1;
+            return 1;
+        }
+
+        /* The pipe is exported to make processes, which require blocking
+         * reads, so threads wait for tokens on a separate descriptor */
+        bake_jobserver_owned = true;
+        bake_jobserver_open_poll();
+
+        /* The process itself holds one implicit slot */
+        uint32_t i;
+        for (i = 1; i < jobs; i ++) {
+            char token = '+';
+            if (write(bake_jobserver_fds[1], &token, 1) != 1) {
+                corto_warning("failed to initialize jobserver: %s", strerror(errno));
+                break;
+            }
+        }
+
+        /* Export jobserver so make processes started by bake share slots */
+        const char *makeflags = corto_getenv("MAKEFLAGS");
+        corto_setenv("MAKEFLAGS", " -j%u --jobserver-fds=%d,%d --jobserver-auth=%d,%d%s%s",
+            jobs,
+            bake_jobserver_fds[0], bake_jobserver_fds[1],
+            bake_jobserver_fds[0], bake_jobserver_fds[1],
+            makeflags ? " " : "",
+            makeflags ? makeflags : "");
+    }
+
+    return jobs;
+}
+
+void bake_jobserver_deinit(void)
+{
+    if (bake_jobserver_poll_fd != -1 &&
+        bake_jobserver_poll_fd != bake_jobserver_fds[0])
+    {
+        close(bake_jobserver_poll_fd);
+    }
+    bake_jobserver_poll_fd = -1;
+
+    if (bake_jobserver_owned) {
+        close(bake_jobserver_fds[0]);
+        if (bake_jobserver_fds[1] != bake_jobserver_fds[0]) {
+            close(bake_jobserver_fds[1]);
+        }
+        bake_jobserver_owned = false;
+    }
+    bake_jobserver_fds[0] = bake_jobserver_fds[1] = -1;
+}
+
+int16_t bake_jobserver_acquire(
+    char *token_out,
+    bake_jobserver_cancel_cb cancel,
+    void *ctx)
+{
+    if (bake_jobserver_fds[0] == -1) {
+        /* No jobserver, number of jobs is only bounded by threads */
+        *token_out = '+';
+        return 0;
+    }
+
+    for (;;) {
+        if (cancel && cancel(ctx)) {
+            return 1;
+        }
+
+        struct pollfd pfd = {.fd = bake_jobserver_poll_fd, .events = POLLIN};
+        int ret = poll(&pfd, 1, BAKE_JOBSERVER_POLL_INTERVAL);
+        if (ret < 0 && errno != EINTR) {
+            corto_throw("failed to wait for jobserver: %s", strerror(errno));
+            goto error;
+        }
+
+        if (ret > 0) {
+            /* Another process may have taken the token between poll and read */
+            ssize_t count = read(bake_jobserver_poll_fd, token_out, 1);
+            if (count == 1) {
+                return 0;
+            } else if (count < 0 && errno != EAGAIN && errno != EINTR) {
+                corto_throw("failed to read from jobserver: %s", strerror(errno));
+                goto error;
+            }
+        }
+    }
+
+error:
+    return -1;
+}
+
+void bake_jobserver_release(
+    char token)
+{
+    if (bake_jobserver_fds[1] != -1) {
+        while (write(bake_jobserver_fds[1], &token, 1) != 1) {
+            if (errno != EINTR) {
+                corto_warning("failed to return token to jobserver: %s",
+                    strerror(errno));
+                break;
+            }
+        }
+    }
+}
+
+static
+bool bake_jobs_done(
+    void *ctx)
+{
+    bake_jobs *pool = ctx;
+    corto_mutex_lock(&pool->lock);
+    bool result = pool->failed || !corto_ll_count(pool->jobs);
+    corto_mutex_unlock(&pool->lock);
+    return result;
+}
+
+static
+int16_t bake_jobs_work(
+    bake_jobs *pool,
+    bool use_token)
+{
+    int16_t result = 0;
+
+    for (;;) {
+        void *job = NULL;
+        char token = 0;
+
+        /* Threads other than the calling thread need a slot for each job */
+        if (use_token) {
+            int16_t ret = bake_jobserver_acquire(&token, bake_jobs_done, pool);
+            if (ret == 1) {
+                break;
+            } else if (ret) {
+                corto_mutex_lock(&pool->lock);
+                pool->failed = true;
+                corto_mutex_unlock(&pool->lock);
+                result = -1;
+                break;
+            }
+        }
+
+        corto_mutex_lock(&pool->lock);
+        if (!pool->failed) {
+            job = corto_ll_takeFirst(pool->jobs);
+        }
+        corto_mutex_unlock(&pool->lock);
+
+        if (job) {
+            if (pool->action(job, pool->ctx)) {
+                corto_mutex_lock(&pool->lock);
+                pool->failed = true;
+                corto_mutex_unlock(&pool->lock);
+                result = -1;
+            }
+        }
+
+        if (use_token) {
+            bake_jobserver_release(token);
+        }
+
+        if (!job || result) {
+            break;
+        }
+    }
+
+    return result;
+}
+
+static
+void* bake_jobs_worker(
+    void *arg)
+{
+    if (bake_jobs_work(arg, true)) {
+        /* Errors are stored per thread, so report before the thread exits */
+        corto_raise();
+    }
+    return NULL;
+}
+
+int16_t bake_jobs_run(
+    uint32_t threads,
+    corto_ll jobs,
+    bake_job_cb action,
+    void *ctx)
+{
+    uint32_t i, count = corto_ll_count(jobs);
+    corto_thread *workers = NULL;
+    bake_jobs pool = {
+        .jobs = jobs,
+        .action = action,
+        .ctx = ctx
+    };
+
+    if (corto_mutex_new(&pool.lock)) {
+        corto_throw("failed to initialize job pool");
+        goto error;
+    }
+
+    /* Don't start more threads than there are jobs */
+    if (threads > count) {
+        threads = count;
+    }
+
+    if (threads > 1) {
+        workers = corto_alloc(sizeof(corto_thread) * threads);
+        for (i = 1; i < threads; i ++) {
+            workers[i] = corto_thread_new(bake_jobs_worker, &pool);
+            if (!workers[i]) {
+                /* Continue with the workers that did start */
+                corto_warning("failed to start job thread, using %u threads", i);
+                threads = i;
+                break;
+            }
+        }
+    }
+
+    int16_t ret = bake_jobs_work(&pool, false);
+
+    if (workers) {
+        for (i = 1; i < threads; i ++) {
+            corto_thread_join(workers[i], NULL);
+        }
+        free(workers);
+    }
+
+    corto_mutex_free(&pool.lock);
+
+    if (ret) {
+        corto_throw(NULL);
+        goto error;
+    } else if (pool.failed) {
+        corto_throw("job failed");
+        goto error;
+    }
+
+    return 0;
+error:
+    return -1;
+}
@@ -0,0 +1,92 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section jobs Job pool
+ * @brief Runs a list of independent jobs on a bounded number of threads.
+ *
+ * The total number of jobs that run in a bake process is bounded by a token
+ * based budget that is compatible with the GNU make jobserver. Each process
+ * may run one job without a token; every additional job must hold a token.
+ * Tokens are shared with make processes started by bake, and with the make
+ * process that started bake (if any).
+ */
+
+/** Initialize job slot budget.
+ * If bake is started by a make (or bake) process that provides a jobserver,
+ * bake joins its budget. Otherwise a jobserver with the specified number of
+ * slots is created and exported in MAKEFLAGS, so that child processes share it.
+ *
+ * @param jobs Number of slots as specified by the user, 0 if not specified.
+ * @return Maximum number of threads bake should use for running jobs.
+ */
+uint32_t bake_jobserver_init(
+    uint32_t jobs);
+
+/** Release resources of the jobserver. */
+void bake_jobserver_deinit(void);
+
+typedef bool (*bake_jobserver_cancel_cb)(void *ctx);
+
+/** Acquire a job slot.
+ * Waits until a token becomes available. While waiting, the cancel callback
+ * is periodically invoked; if it returns true, waiting is aborted.
+ *
+ * @param token_out Token that must be passed to bake_jobserver_release.
+ * @param cancel Callback that indicates whether to stop waiting (may be NULL).
+ * @param ctx Context passed to cancel.
+ * @return 0 if acquired, 1 if cancelled, -1 if failed.
+ */
+int16_t bake_jobserver_acquire(
+    char *token_out,
+    bake_jobserver_cancel_cb cancel,
+    void *ctx);
+
+/** Release a job slot.
+ *
+ * @param token Token obtained by bake_jobserver_acquire.
+ */
+void bake_jobserver_release(
+    char token);
+
+typedef int16_t (*bake_job_cb)(void *job, void *ctx);
+
+/** Run jobs in parallel.
+ * Jobs are started in list order on at most the specified number of threads,
+ * of which the calling thread is one. The calling thread uses the job slot it
+ * already occupies; other threads acquire a token from the jobserver for each
+ * job. When a job fails, no new jobs are started, and the function returns
+ * after running jobs have finished.
+ *
+ * Errors of jobs that run on other threads than the calling thread are
+ * reported when the thread exits.
+ *
+ * @param threads Maximum number of jobs that may run at the same time.
+ * @param jobs List of jobs. The list is emptied by the function.
+ * @param action Callback that runs a single job.
+ * @param ctx Context passed to action.
+ * @return 0 if all jobs succeeded, non-zero if a job failed.
+ */
+int16_t bake_jobs_run(
+    uint32_t threads,
+    corto_ll jobs,
+    bake_job_cb action,
+    void *ctx);
@@ -20,26 +20,29 @@
  */
 
 #include "bake.h"
+#include <sys/stat.h>
 
 static corto_ll languages;
 
 extern corto_tls BAKE_LANGUAGE_KEY;
 extern corto_tls BAKE_FILELIST_KEY;
 extern corto_tls BAKE_PROJECT_KEY;
+extern corto_tls BAKE_JOB_ERROR_KEY;
+extern struct corto_mutex_s BAKE_LANGUAGE_LOCK;
 
 typedef int (*buildmain_cb)(bake_language *l);
 
 static
-bake_node* bake_node_find(
+bake_dependency_rule* bake_language_findDependencyRule(
     bake_language *l,
     const char *name)
 {
-    corto_iter it = corto_ll_iter(l->nodes);
-    bake_node *result = NULL;
+    corto_iter it = corto_ll_iter(l->dependency_rules);
+    bake_dependency_rule *result = NULL;
 
     while (corto_iter_hasNext(&it)) {
-        bake_node *e = corto_iter_next(&it);
-        if (!strcmp(e->name, name)) {
+        bake_dependency_rule *e = corto_iter_next(&it);
+        if (!strcmp(((bake_node*)e)->name, name)) {
             result = e;
             break;
         }
@@ -48,6 +51,19 @@ bake_node* bake_node_find(
     return result;
 }
 
+static
+bake_node* bake_node_find(
+    bake_language *l,
+    const char *name)
+{
+    return corto_rb_find(l->node_index, name);
+}
+
+static
+int bake_node_cmp(void *ctx, const void* key1, const void* key2) {
+    return strcmp(key1, key2);
+}
+
 static
 void bake_language_pattern_cb(
     const char *name,
@@ -138,20 +154,39 @@ void bake_language_clean_cb(
     l->clean_cb = clean;
 }
 
+/* Actions of mapped rules run in parallel, so commands report failure to the
+ * job that runs them instead of to the shared project error flag */
+static
+void bake_language_set_error(
+    bake_project *p)
+{
+    bool *job_error = corto_tls_get(BAKE_JOB_ERROR_KEY);
+    if (job_error) {
+        *job_error = true;
+    } else {
+        p->error = true;
+    }
+}
+
 static
 void bake_language_exec_cb(
     const char *cmd)
 {
+    bake_project *p = corto_tls_get(BAKE_PROJECT_KEY);
     char *envcmd = corto_envparse("%s", cmd);
     if (!envcmd) {
         corto_throw("invalid command '%s'", cmd);
-        bake_project *p = corto_tls_get(BAKE_PROJECT_KEY);
-        p->error = true;
+        bake_language_set_error(p);
     } else {
         int8_t ret = 0;
         int sig = 0;
-        if ((sig = corto_proc_cmd(envcmd, &ret)) || ret) {
-            if (!sig) {
+
+        /* Run command from project directory */
+        if ((sig = bake_exec(p->path, envcmd, NULL, &ret)) || ret) {
+            if (sig < 0) {
+                corto_throw("failed to run command");
+                corto_throw_detail("%s", envcmd);
+            } else if (!sig) {
                 corto_throw("command returned %d", ret);
                 corto_throw_detail("%s", envcmd);
             } else {
@@ -159,8 +194,7 @@ void bake_language_exec_cb(
                 corto_throw_detail("%s", envcmd);
             }
 
-            bake_project *p = corto_tls_get(BAKE_PROJECT_KEY);
-            p->error = true;
+            bake_language_set_error(p);
         }
         free(envcmd);
     }
@@ -172,6 +206,7 @@ void* bake_node_add(
     void *n) /* void* to prevent excessive upcasting */
 {
     corto_ll_append(l->nodes, n);
+    corto_rb_set(l->node_index, ((bake_node*)n)->name, n);
     return n;
 }
 
@@ -210,43 +245,78 @@ error:
     return -1;
 }
 
+/* Resolve nodes referred to by target pattern of rule, so they don't have to
+ * be looked up every time the rule is evaluated */
 static
-int16_t bake_node_addToTarget(
+int16_t bake_node_resolveTargets(
     bake_language *l,
-    bake_node *node,
-    bake_rule_target *target)
+    bake_rule *r)
 {
     const char *pattern = NULL;
-    if (target->kind == BAKE_RULE_TARGET_PATTERN) {
-        pattern = target->is.pattern;
+    char *dup = NULL;
+
+    if (r->target_nodes) {
+        corto_ll_clear(r->target_nodes);
+    }
+
+    if (r->target.kind == BAKE_RULE_TARGET_PATTERN) {
+        pattern = r->target.is.pattern;
     }
 
     /* If target specifies n targets, target is dynamic and there is no node
      * representing the target. */
     if (pattern) {
-        char *dup = corto_strdup(pattern);
+        dup = corto_strdup(pattern);
         char *tok = strtok(dup, ",");
+
+        if (!r->target_nodes) {
+            r->target_nodes = corto_ll_new();
+        }
+
         while (tok) {
             if (tok[0] != '$') {
                 corto_throw("target '%s' for rule '%s' does not refer named node",
-                    pattern, node->name);
+                    pattern, ((bake_node*)r)->name);
                 goto error;
             }
 
             bake_node *targetNode = bake_node_find(l, &tok[1]);
             if (!targetNode) {
                 corto_throw("unresolved target '%s' for node '%s'",
-                    tok, node->name);
+                    tok, ((bake_node*)r)->name);
                 goto error;
             }
 
-            if (!targetNode->deps) targetNode->deps = corto_ll_new();
-            corto_ll_append(targetNode->deps, node);
+            corto_ll_append(r->target_nodes, targetNode);
             tok = strtok(NULL, ",");
         }
         free(dup);
     }
 
+    return 0;
+error:
+    if (dup) free(dup);
+    return -1;
+}
+
+static
+int16_t bake_node_addToTarget(
+    bake_language *l,
+    bake_rule *r)
+{
+    if (bake_node_resolveTargets(l, r)) {
+        goto error;
+    }
+
+    if (r->target_nodes) {
+        corto_iter it = corto_ll_iter(r->target_nodes);
+        while (corto_iter_hasNext(&it)) {
+            bake_node *targetNode = corto_iter_next(&it);
+            if (!targetNode->deps) targetNode->deps = corto_ll_new();
+            corto_ll_append(targetNode->deps, r);
+        }
+    }
+
     return 0;
 error:
     return -1;
@@ -290,6 +360,10 @@ void bake_language_rule(
             ((bake_rule*)n)->source = source;
             ((bake_rule*)n)->target = target;
             ((bake_rule*)n)->action = action;
+            if (bake_node_resolveTargets(l, (bake_rule*)n)) {
+                corto_throw(NULL);
+                l->error = 1;
+            }
         }
     } else {
         bake_node *n = bake_node_add(l, bake_rule_new(name, source, target, action));
@@ -297,7 +371,7 @@ void bake_language_rule(
             corto_throw(NULL);
             l->error = 1;
         }
-        if (bake_node_addToTarget(l, n, &target)) {
+        if (bake_node_addToTarget(l, (bake_rule*)n)) {
             corto_throw(NULL);
             l->error = 1;
         }
@@ -311,11 +385,24 @@ void bake_language_dependency_rule(
     bake_rule_target dep_mapping,
     bake_rule_action_cb action)
 {
-    if (bake_node_find(l, name)) {
+    /* Dependency files are found with dep_mapping. The deps argument is kept
+     * so that existing drivers don't have to change. */
+    if (deps) {
+        corto_trace("dependencies '%s' of dependency rule '%s' are ignored",
+            deps, name);
+    }
+
+    if (bake_language_findDependencyRule(l, name)) {
+        l->error = 1;
+        corto_error("dependency rule '%s' redeclared", name);
+    } else if (dep_mapping.kind != BAKE_RULE_TARGET_MAP) {
         l->error = 1;
-        corto_error("rule '%s' redeclared with dependencies = '%s'", name, deps);
+        corto_error("dependency rule '%s' must map inputs to dependency files", name);
     } else {
-        bake_node_add(l, bake_dependency_rule_new(name, deps, dep_mapping, action));
+        /* Dependency rules have the same name as the rule they apply to, so
+         * they are stored separately from the other nodes */
+        corto_ll_append(l->dependency_rules,
+            bake_dependency_rule_new(name, deps, dep_mapping, action));
     }
 }
 
@@ -323,25 +410,271 @@ static
 int16_t bake_assertPathForFile(
     char *path)
 {
-    char buffer[512];
-    strcpy(buffer, path);
-    char *ptr = strrchr(buffer, '/');
+    char *dir = corto_strdup(path);
+    char *ptr = strrchr(dir, '/');
     if (ptr) {
         ptr[0] = '\0';
     }
 
-    if (!corto_file_test(buffer)) {
-        if (corto_mkdir(buffer)) {
+    if (!corto_file_test(dir)) {
+        if (corto_mkdir(dir)) {
             corto_throw(NULL);
             goto error;
         }
     }
 
+    free(dir);
     return 0;
 error:
+    free(dir);
     return -1;
 }
 
+/* Compute hash of a list of input files. The hash includes the file names, so
+ * that adding or removing a file changes the hash. Returns 0 if an input
+ * could not be read. */
+static
+uint64_t bake_node_inputs_hash(
+    bake_project *p,
+    bake_file **files,
+    uint32_t count)
+{
+    uint64_t hash = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i ++) {
+        bake_file *f = files[i];
+        char *path = f->name;
+        if (f->offset) {
+            path = corto_asprintf("%s/%s", f->offset, f->name);
+        }
+
+        uint64_t file_hash = bake_db_file_hash(p->db, path);
+        hash = bake_db_hash(hash, path, strlen(path) + 1);
+        hash = bake_db_hash(hash, &file_hash, sizeof(file_hash));
+
+        if (path != f->name) {
+            free(path);
+        }
+
+        if (!file_hash) {
+            return 0;
+        }
+    }
+
+    return hash;
+}
+
+static
+uint64_t bake_node_hash_str(
+    uint64_t hash,
+    const char *str)
+{
+    /* Include terminator, so that ("ab", "c") and ("a", "bc") differ */
+    if (str) {
+        return bake_db_hash(hash, str, strlen(str) + 1);
+    } else {
+        return bake_db_hash(hash, "", 1);
+    }
+}
+
+static
+uint64_t bake_node_hash_list(
+    uint64_t hash,
+    corto_ll list)
+{
+    if (list) {
+        corto_iter it = corto_ll_iter(list);
+        while (corto_iter_hasNext(&it)) {
+            hash = bake_node_hash_str(hash, corto_iter_next(&it));
+        }
+    }
+    return bake_node_hash_str(hash, NULL);
+}
+
+static
+uint64_t bake_node_hash_attr(
+    uint64_t hash,
+    bake_project_attr *attr)
+{
+    hash = bake_node_hash_str(hash, attr->name);
+    hash = bake_db_hash(hash, &attr->kind, sizeof(attr->kind));
+    switch (attr->kind) {
+    case BAKE_ATTR_BOOLEAN:
+        hash = bake_db_hash(hash, &attr->is.boolean, sizeof(bool));
+        break;
+    case BAKE_ATTR_STRING:
+        hash = bake_node_hash_str(hash, attr->is.string);
+        break;
+    case BAKE_ATTR_NUMBER:
+        hash = bake_db_hash(hash, &attr->is.number, sizeof(double));
+        break;
+    case BAKE_ATTR_ARRAY: {
+        corto_iter it = corto_ll_iter(attr->is.array);
+        while (corto_iter_hasNext(&it)) {
+            hash = bake_node_hash_attr(hash, corto_iter_next(&it));
+        }
+        hash = bake_node_hash_str(hash, NULL);
+        break;
+    }
+    }
+    return hash;
+}
+
+/* Environment variables that select or configure the toolchain that commands
+ * assembled by a language binding run. PATH is not included, as it differs
+ * between shells and IDEs that run the same compiler. */
+static const char *bake_node_signature_env[] = {
+    "CC", "CXX", "CPP", "LD", "AR",
+    "CFLAGS", "CXXFLAGS", "CPPFLAGS", "LDFLAGS",
+    "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH", "LIBRARY_PATH",
+    NULL
+};
+
+/* Environment variables that name a tool */
+static const char *bake_node_signature_tools[] = {
+    "CC", "CXX", "CPP", "LD", "AR",
+    NULL
+};
+
+/* Hash identity of the tool that a command runs, so that a different tool
+ * with the same name (for example after changing PATH) rebuilds targets. */
+static
+uint64_t bake_node_hash_tool(
+    uint64_t hash,
+    const char *cmd)
+{
+    struct stat st;
+    char *found = NULL;
+
+    if (!cmd) {
+        return hash;
+    }
+
+    /* Tool is the first word of the command */
+    char *tool = corto_strdup(cmd);
+    char *end = strchr(tool, ' ');
+    if (end) *end = '\0';
+
+    if (strchr(tool, '/')) {
+        if (!stat(tool, &st)) {
+            found = corto_strdup(tool);
+        }
+    } else {
+        const char *path = corto_getenv("PATH");
+        const char *dir = path;
+        while (dir && *dir) {
+            const char *sep = strchr(dir, ':');
+            int len = sep ? sep - dir : (int)strlen(dir);
+            char *file = corto_asprintf("%.*s/%s", len, dir, tool);
+            if (!stat(file, &st) && S_ISREG(st.st_mode) && !access(file, X_OK)) {
+                found = file;
+                break;
+            }
+            free(file);
+            dir = sep ? sep + 1 : NULL;
+        }
+    }
+
+    if (found) {
+        uint64_t identity[] = {bake_mtime_stat(&st), (uint64_t)st.st_size};
+        hash = bake_node_hash_str(hash, found);
+        hash = bake_db_hash(hash, identity, sizeof(identity));
+        free(found);
+    } else {
+        hash = bake_node_hash_str(hash, NULL);
+    }
+
+    free(tool);
+
+    return hash;
+}
+
+/* Compute signature of a rule action. Commands are assembled by the language
+ * binding while the action runs, so the signature is computed from everything
+ * the language binding can use to assemble them: the contents of the binding
+ * itself, the build configuration, project settings, attributes of
+ * project.json, configured environment variables, the environment
+ * variables of the toolchain and the tools they name. When the signature of a
+ * target changes, it is rebuilt. */
+static
+uint64_t bake_node_signature(
+    bake_language *l,
+    bake_project *p,
+    bake_config *c,
+    bake_rule *r)
+{
+    uint64_t hash = 0;
+
+    /* Rule */
+    hash = bake_node_hash_str(hash, l->name);
+    hash = bake_node_hash_str(hash, ((bake_node*)r)->name);
+
+    /* Language binding, as a new version may assemble different commands */
+    const char *driver = corto_locate(l->package, NULL, CORTO_LOCATE_LIB);
+    uint64_t driver_hash = driver ? bake_db_file_hash(p->db, driver) : 0;
+    hash = bake_db_hash(hash, &driver_hash, sizeof(driver_hash));
+
+    /* Configuration */
+    hash = bake_node_hash_str(hash, c->environment);
+    hash = bake_node_hash_str(hash, c->id);
+    bool flags[] = {c->symbols, c->debug, c->optimizations, c->coverage, c->strict};
+    hash = bake_db_hash(hash, flags, sizeof(flags));
+
+    if (c->variables) {
+        corto_iter it = corto_ll_iter(c->variables);
+        while (corto_iter_hasNext(&it)) {
+            char *var = corto_iter_next(&it);
+            hash = bake_node_hash_str(hash, var);
+            hash = bake_node_hash_str(hash, corto_getenv(var));
+        }
+    }
+    hash = bake_node_hash_str(hash, NULL);
+
+    const char **env;
+    for (env = bake_node_signature_env; *env; env ++) {
+        hash = bake_node_hash_str(hash, corto_getenv(*env));
+    }
+    for (env = bake_node_signature_tools; *env; env ++) {
+        hash = bake_node_hash_tool(hash, corto_getenv(*env));
+    }
+
+    /* Project. Language bindings may add the id to commands (for example to
+     * define export macros), so outputs of different projects can differ even
+     * if their inputs and settings are the same. */
+    hash = bake_node_hash_str(hash, p->id);
+    hash = bake_node_hash_str(hash, p->language);
+    hash = bake_node_hash_str(hash, p->args);
+    hash = bake_node_hash_str(hash, p->version);
+    hash = bake_db_hash(hash, &p->kind, sizeof(p->kind));
+    bool settings[] = {p->public, p->managed, p->use_generated_api};
+    hash = bake_db_hash(hash, settings, sizeof(settings));
+    hash = bake_node_hash_list(hash, p->use);
+    hash = bake_node_hash_list(hash, p->use_build);
+    hash = bake_node_hash_list(hash, p->link);
+    hash = bake_node_hash_list(hash, p->sources);
+    hash = bake_node_hash_list(hash, p->includes);
+
+    if (p->attributes) {
+        corto_iter it = corto_ll_iter(p->attributes);
+        while (corto_iter_hasNext(&it)) {
+            hash = bake_node_hash_attr(hash, corto_iter_next(&it));
+        }
+    }
+
+    return hash;
+}
+
+/* Discard cached directory listings after files were created by an action */
+static
+void bake_language_invalidateDirs(
+    bake_project *p)
+{
+    if (p->dircache) {
+        bake_dircache_invalidate(p->dircache);
+    }
+}
+
 static
 bake_filelist* bake_node_eval_pattern(
     bake_node *n,
@@ -352,35 +685,28 @@ bake_filelist* bake_node_eval_pattern(
 
     corto_trace("evaluating pattern");
     if (n->name && !stricmp(n->name, "SOURCES")) {
-        targets = bake_filelist_new(NULL, NULL); /* Create empty list */
+        targets = bake_filelist_new(p->path, NULL); /* Create empty list */
         isSources = true;
 
         /* If this is the special SOURCES rule, apply the pattern to
          * every configured source directory */
         corto_iter it = corto_ll_iter(p->sources);
-        corto_dirstack ds = NULL;
         while (corto_iter_hasNext(&it)) {
             char *src = corto_iter_next(&it);
-            if (!(ds = corto_dirstack_push(ds, src))) {
-                corto_throw(NULL);
-                goto error;
-            }
-
             if (bake_filelist_addPattern(targets, src, ((bake_pattern*)n)->pattern)) {
                 corto_throw(NULL);
                 goto error;
             }
-            corto_dirstack_pop(ds);
         }
     } else if (n->name && !stricmp(n->name, "MODEL") && p->model) {
-        targets = bake_filelist_new(NULL, NULL); /* Create empty list */
+        targets = bake_filelist_new(p->path, NULL); /* Create empty list */
         if (!bake_filelist_add(targets, p->model)) {
             corto_throw(NULL);
             goto error;
         }
     } else if (((bake_pattern*)n)->pattern) {
         /* If this is a regular pattern, match against project directory */
-        targets = bake_filelist_new(NULL, ((bake_pattern*)n)->pattern);
+        targets = bake_filelist_new(p->path, ((bake_pattern*)n)->pattern);
     }
 
     if (!targets) {
@@ -392,6 +718,345 @@ error:
     return NULL;
 }
 
+/* Action for a single target of a map rule */
+typedef struct bake_rule_map_job {
+    bake_file *src;
+    bake_file *dst;
+    char *srcPath; /* relative to project, passed to action */
+    char *dstPath; /* absolute path of target */
+    uint64_t inputs; /* hash of inputs, recorded in build database */
+    bool error; /* set by commands that failed while running the action */
+} bake_rule_map_job;
+
+/* State shared by the jobs of a map rule */
+typedef struct bake_rule_map_ctx {
+    bake_language *l;
+    bake_project *p;
+    bake_config *c;
+    bake_rule *r;
+    bake_dependency_rule *dr; /* dependency rule for targets (optional) */
+    uint64_t signature; /* signature of the rule action */
+    corto_rb timestamps; /* timestamps of dependencies, shared by targets */
+    uint64_t total; /* number of inputs */
+    uint64_t count; /* number of processed inputs, for progress reporting */
+    bool failed; /* a job failed, protected by lock */
+    struct corto_mutex_s lock;
+} bake_rule_map_ctx;
+
+/* Timestamp of a file listed as dependency */
+typedef struct bake_rule_map_timestamp {
+    char *file;
+    uint64_t timestamp; /* 0 if file does not exist */
+} bake_rule_map_timestamp;
+
+static
+int bake_node_timestamp_cmp(void *ctx, const void* key1, const void* key2) {
+    return strcmp(key1, key2);
+}
+
+/* Files like headers are dependencies of many targets, so only get the
+ * timestamp once per rule */
+static
+uint64_t bake_node_dependency_timestamp(
+    bake_rule_map_ctx *map,
+    const char *file)
+{
+    bake_rule_map_timestamp *t = corto_rb_find(map->timestamps, file);
+    if (!t) {
+        struct stat st;
+        char *path = bake_project_file(map->p, file);
+        t = corto_calloc(sizeof(bake_rule_map_timestamp));
+        t->file = corto_strdup(file);
+        t->timestamp = stat(path, &st) ? 0 : bake_mtime_stat(&st);
+        corto_rb_set(map->timestamps, t->file, t);
+        free(path);
+    }
+    return t->timestamp;
+}
+
+static
+void bake_node_free_timestamps(
+    corto_rb timestamps)
+{
+    corto_iter it = corto_rb_iter(timestamps);
+    while (corto_iter_hasNext(&it)) {
+        bake_rule_map_timestamp *t = corto_iter_next(&it);
+        free(t->file);
+        free(t);
+    }
+    corto_rb_free(timestamps);
+}
+
+/* Add dependencies of a target to a hash of its inputs */
+static
+uint64_t bake_node_deps_hash(
+    bake_project *p,
+    uint64_t hash,
+    corto_ll deps)
+{
+    if (!deps) {
+        return hash;
+    }
+
+    corto_iter it = corto_ll_iter(deps);
+    while (hash && corto_iter_hasNext(&it)) {
+        char *file = corto_iter_next(&it);
+        uint64_t file_hash = bake_db_file_hash(p->db, file);
+        if (!file_hash) {
+            return 0;
+        }
+        hash = bake_db_hash(hash, file, strlen(file) + 1);
+        hash = bake_db_hash(hash, &file_hash, sizeof(file_hash));
+    }
+    return hash;
+}
+
+/* Get dependencies of a target from its dependency file. Dependency files are
+ * only parsed when they changed since they were last parsed. If the dependency
+ * file does not exist and generate is true, the dependency rule action is
+ * invoked to create it. Returns NULL if there is no dependency file. */
+static
+corto_ll bake_node_get_deps(
+    bake_rule_map_ctx *map,
+    bake_file *src,
+    const char *srcPath,
+    bake_file *dst,
+    bool generate,
+    bool reparse)
+{
+    bake_project *p = map->p;
+    bake_dependency_rule *dr = map->dr;
+    corto_ll deps = NULL;
+    struct stat st;
+
+    const char *depfile = dr->target.is.map(map->l, p, src->name, NULL);
+    if (!depfile) {
+        return NULL;
+    }
+
+    char *path = bake_project_file(p, depfile);
+    if (stat(path, &st) && generate && dr->action) {
+        char *depfile_arg = corto_strdup(depfile);
+        if (!bake_assertPathForFile(path)) {
+            dr->action(map->l, p, map->c, (char*)srcPath, depfile_arg, NULL);
+        }
+        free(depfile_arg);
+        if (p->error) {
+            corto_throw("failed to generate dependencies for '%s'", src->name);
+            goto error;
+        }
+    }
+
+    if (!stat(path, &st)) {
+        if (!reparse) {
+            deps = bake_db_deps_get(p->db, dst->name, bake_mtime_stat(&st));
+        }
+        if (!deps) {
+            corto_ll parsed = bake_depfile_parse(path);
+            if (parsed) {
+                bake_db_deps_set(p->db, dst->name, bake_mtime_stat(&st), parsed);
+                deps = parsed;
+            }
+        }
+    }
+
+error:
+    free(path);
+    return deps;
+}
+
+/* Absolute path of the dependency file of a target */
+static
+char* bake_node_depfile(
+    bake_rule_map_ctx *map,
+    bake_file *src)
+{
+    const char *depfile = map->dr->target.is.map(map->l, map->p, src->name, NULL);
+    return depfile ? bake_project_file(map->p, depfile) : NULL;
+}
+
+/* Try to retrieve target from object cache. Cached targets are looked up by
+ * the source and action signature in a manifest, which lists the sets of
+ * dependencies the target has been built with. If the current contents of
+ * one of those sets yield a key that is in the cache, the target is retrieved.
+ * Returns 0 if retrieved, 1 if not found, -1 if failed. */
+static
+int16_t bake_node_cache_fetch(
+    bake_rule_map_ctx *map,
+    bake_rule_map_job *job)
+{
+    const char *cache = map->c->cache;
+    uint64_t manifest_key = bake_db_hash(
+        job->inputs, &map->signature, sizeof(uint64_t));
+    int16_t result = 1;
+
+    corto_ll manifest = bake_cache_manifest_load(cache, manifest_key);
+    if (!manifest) {
+        return 1;
+    }
+
+    corto_iter it = corto_ll_iter(manifest);
+    while (result == 1 && corto_iter_hasNext(&it)) {
+        corto_ll deps = corto_iter_next(&it);
+        uint64_t inputs = bake_node_deps_hash(map->p, job->inputs, deps);
+        if (!inputs) {
+            continue; /* a dependency no longer exists */
+        }
+
+        uint64_t key = bake_db_hash(inputs, &map->signature, sizeof(uint64_t));
+        result = bake_cache_fetch(cache, key, "o", job->dstPath, true);
+        if (!result && map->dr) {
+            char *depfile = bake_node_depfile(map, job->src);
+            if (depfile) {
+                result = bake_cache_fetch(cache, key, "d", depfile, false);
+                free(depfile);
+            }
+        }
+    }
+
+    bake_cache_manifest_free(manifest);
+
+    return result;
+}
+
+/* Add a target that was just built to the object cache */
+static
+void bake_node_cache_store(
+    bake_rule_map_ctx *map,
+    bake_rule_map_job *job,
+    uint64_t src_hash,
+    corto_ll deps)
+{
+    const char *cache = map->c->cache;
+    uint64_t key = bake_db_hash(job->inputs, &map->signature, sizeof(uint64_t));
+    uint64_t manifest_key = bake_db_hash(src_hash, &map->signature, sizeof(uint64_t));
+
+    if (bake_cache_store(cache, key, "o", job->dstPath)) {
+        goto error;
+    }
+
+    if (map->dr) {
+        char *depfile = bake_node_depfile(map, job->src);
+        if (depfile) {
+            int16_t ret = bake_cache_store(cache, key, "d", depfile);
+            free(depfile);
+            if (ret) {
+                goto error;
+            }
+        }
+    }
+
+    if (bake_cache_manifest_add(cache, manifest_key, deps)) {
+        goto error;
+    }
+
+    return;
+error:
+    /* The cache is an optimization, don't fail the build */
+    corto_warning("failed to add '%s' to object cache", job->dst->name);
+    corto_catch();
+}
+
+static
+int16_t bake_node_run_rule_map_job(
+    void *arg,
+    void *ctx)
+{
+    bake_rule_map_job *job = arg;
+    bake_rule_map_ctx *map = ctx;
+    bake_project *p = map->p;
+    int16_t result = 0;
+
+    /* Another job may have failed while this job was waiting */
+    corto_mutex_lock(&map->lock);
+    bool failed = map->failed;
+    corto_mutex_unlock(&map->lock);
+
+    if (!failed) {
+        corto_mutex_lock(&map->lock);
+        map->count ++;
+        corto_log_overwrite(CORTO_OK, "#[green][#[white]%3d%%#[green]]#[white] %s",
+            100 * map->count / map->total,
+            job->src->name);
+        corto_mutex_unlock(&map->lock);
+
+        /* Commands invoked by the action look up project in thread storage */
+        corto_tls_set(BAKE_PROJECT_KEY, p);
+
+        /* Without dependency rule, this is the hash of all inputs */
+        uint64_t src_hash = job->inputs;
+
+        int16_t cached = 1;
+        if (map->c->cache && job->inputs) {
+            if ((cached = bake_node_cache_fetch(map, job)) == -1) {
+                corto_warning("failed to retrieve '%s' from object cache",
+                    job->dst->name);
+                corto_catch();
+            } else if (!cached) {
+                corto_trace("retrieved '%s' from object cache", job->dst->name);
+            }
+        }
+
+        if (cached) {
+            /* Targets retrieved from the cache by an earlier build may be
+             * hardlinks, also when this build doesn't use the cache, so make
+             * sure the action does not write through them into the cache */
+            unlink(job->dstPath);
+
+            /* Invoke action. Commands it runs report errors to this job */
+            corto_tls_set(BAKE_JOB_ERROR_KEY, &job->error);
+            map->r->action(map->l, p, map->c, job->srcPath, job->dst->name, NULL);
+            corto_tls_set(BAKE_JOB_ERROR_KEY, NULL);
+        }
+
+        /* Check if error flag was set */
+        if (job->error) {
+            corto_throw("command for task '%s' failed", job->src->name);
+            corto_mutex_lock(&map->lock);
+            map->failed = true;
+            corto_mutex_unlock(&map->lock);
+            result = -1;
+        } else {
+            corto_ll deps = NULL;
+
+            corto_mutex_lock(&map->lock);
+            p->freshly_baked = true;
+            p->changed = true;
+            corto_mutex_unlock(&map->lock);
+
+            /* Update target with latest timestamp */
+            job->dst->timestamp = bake_mtime(job->dstPath);
+
+            /* The action may have updated the dependency file, so add the
+             * dependencies the target was actually built with */
+            if (map->dr && job->inputs) {
+                deps = bake_node_get_deps(
+                    map, job->src, job->srcPath, job->dst, false, true);
+                job->inputs = bake_node_deps_hash(p, job->inputs, deps);
+            }
+
+            if (job->inputs) {
+                bake_db_output_set(
+                    p->db, job->dst->name, job->inputs, map->signature);
+
+                if (cached && map->c->cache) {
+                    bake_node_cache_store(map, job, src_hash, deps);
+                }
+            }
+        }
+    } else {
+        result = -1;
+    }
+
+    if (job->srcPath != job->src->name) {
+        free(job->srcPath);
+    }
+    free(job->dstPath);
+    free(job);
+
+    return result;
+}
+
 static
 int16_t bake_node_run_rule_map(
     bake_language *l,
@@ -401,63 +1066,180 @@ int16_t bake_node_run_rule_map(
     bake_filelist *inputs,
     bake_filelist *targets)
 {
+    corto_ll jobs = corto_ll_new();
+    bake_rule_map_ctx map = {
+        .l = l, .p = p, .c = c, .r = r,
+        .dr = bake_language_findDependencyRule(l, ((bake_node*)r)->name),
+        .signature = bake_node_signature(l, p, c, r),
+        .timestamps = corto_rb_new(bake_node_timestamp_cmp, NULL),
+        .total = bake_filelist_count(inputs)
+    };
+
+    if (corto_mutex_new(&map.lock)) {
+        corto_throw(NULL);
+        corto_ll_free(jobs);
+        corto_rb_free(map.timestamps);
+        return -1;
+    }
+
+    /* Map inputs to targets, and collect targets that need to be rebuilt */
     corto_iter it = bake_filelist_iter(inputs);
-    int count = 0;
     while (corto_iter_hasNext(&it)) {
         bake_file *src = corto_iter_next(&it);
         bake_file *dst = NULL;
-        const char *map = r->target.is.map(l, p, src->name, NULL);
-        if (!map) {
+        const char *map_result = r->target.is.map(l, p, src->name, NULL);
+        if (!map_result) {
             corto_throw("failed to map file '%s'", src->name);
             goto error;
         }
-        if (!(dst = bake_filelist_add(targets, map))) {
+        if (!(dst = bake_filelist_add(targets, map_result))) {
             corto_throw(NULL);
             goto error;
         }
 
-        count ++;
-        if (src->timestamp > dst->timestamp) {
-            corto_log_overwrite(CORTO_OK, "#[green][#[white]%3d%%#[green]]#[white] %s",
-                100 * count / bake_filelist_count(inputs),
-                src->name);
+        char *srcPath = src->name;
+        if (src->offset) {
+            srcPath = corto_asprintf("%s/%s", src->offset, src->name);
+        }
+
+        /* Timestamps are a cheap first check. If the source appears to be
+         * newer, only rebuild if its contents changed since the target was
+         * built (timestamps change on checkouts and cache restores). */
+        bool outdated = src->timestamp > dst->timestamp;
+        bool rebuild = !dst->timestamp; /* rebuild regardless of contents */
+        corto_ll deps = NULL;
+
+        /* Rebuild if the settings that determine the command changed */
+        uint64_t recorded_inputs = 0, recorded_signature = 0;
+        bool recorded = bake_db_output_get(
+            p->db, dst->name, &recorded_inputs, &recorded_signature);
+        if (!rebuild && recorded && recorded_signature != map.signature) {
+            corto_trace("settings for '%s' changed, rebuilding", dst->name);
+            rebuild = true;
+        }
 
-            /* Make sure target directory exists */
-            if (bake_assertPathForFile(dst->name)) {
+        /* Check if files listed in dependency file (like headers) changed */
+        if (map.dr) {
+            deps = bake_node_get_deps(&map, src, srcPath, dst, true, false);
+            if (p->error) {
+                if (srcPath != src->name) free(srcPath);
                 corto_throw(NULL);
                 goto error;
             }
 
-            /* Invoke action */
-            char *srcPath = src->name;
-            if (src->offset) {
-                srcPath = corto_asprintf("%s/%s", src->offset, src->name);
+            /* Without a dependency file, only the input determines whether
+             * a target that was built before is outdated */
+            if (!deps && !recorded) {
+                corto_trace("no dependencies for '%s', rebuilding", dst->name);
+                rebuild = true;
+            } else if (deps && !rebuild) {
+                corto_iter dep_it = corto_ll_iter(deps);
+                while (!rebuild && corto_iter_hasNext(&dep_it)) {
+                    char *dep = corto_iter_next(&dep_it);
+                    uint64_t timestamp = bake_node_dependency_timestamp(&map, dep);
+                    if (!timestamp) {
+                        corto_trace("dependency '%s' of '%s' does not exist, rebuilding",
+                            dep, dst->name);
+                        rebuild = true;
+                    } else if (!outdated && timestamp > dst->timestamp) {
+                        corto_trace("'%s' is newer than '%s'", dep, dst->name);
+                        outdated = true;
+                    }
+                }
+            }
+        }
+
+        uint64_t src_hash = 0, input_hash = 0;
+        if (outdated || rebuild || !recorded) {
+            src_hash = input_hash = bake_node_inputs_hash(p, &src, 1);
+            if (deps) {
+                input_hash = bake_node_deps_hash(p, src_hash, deps);
+            }
+        }
+
+        if (outdated && !rebuild && input_hash &&
+            input_hash == recorded_inputs)
+        {
+            corto_trace("'%s' is newer than '%s' but did not change",
+                src->name, dst->name);
+            outdated = false;
+        }
+
+        if (outdated || rebuild) {
+            bake_rule_map_job *job = corto_alloc(sizeof(bake_rule_map_job));
+            job->src = src;
+            job->dst = dst;
+            /* With a dependency rule, dependencies are added after the action
+             * ran, as the action may update the dependency file */
+            job->inputs = map.dr ? src_hash : input_hash;
+            job->srcPath = srcPath;
+            job->dstPath = bake_project_file(p, dst->name);
+            job->error = false;
+            corto_ll_append(jobs, job);
+
+            /* Make sure target directory exists before jobs start */
+            if (bake_assertPathForFile(job->dstPath)) {
+                corto_throw(NULL);
+                goto error;
             }
-            r->action(l, p, c, srcPath, dst->name, NULL);
+        } else {
             if (srcPath != src->name) {
                 free(srcPath);
             }
 
-            /* Check if error flag was set */
-            if (p->error) {
-                corto_throw("command for task '%s' failed", src->name);
-                goto error;
-            } else {
-                p->freshly_baked = true;
-                p->changed = true;
+            /* Record inputs of targets built before they were tracked */
+            if (input_hash) {
+                bake_db_output_set(p->db, dst->name, input_hash, map.signature);
             }
 
-            /* Update target with latest timestamp */
-            dst->timestamp = corto_lastmodified(dst->name);
-        } else {
+            map.count ++;
             corto_trace("#[grey][%3d%%] %s",
-                100 * count / bake_filelist_count(inputs),
+                100 * map.count / map.total,
                 src->name);
         }
     }
 
+    /* Run actions for outdated targets in parallel */
+    bool run = corto_ll_count(jobs) != 0;
+    if (bake_jobs_run(c->jobs, jobs, bake_node_run_rule_map_job, &map)) {
+        corto_throw(NULL);
+        goto error;
+    }
+
+    /* Actions that set the project error flag directly are only checked
+     * after all jobs finished, as the flag is not synchronized */
+    if (p->error) {
+        corto_throw("command for rule '%s' failed", ((bake_node*)r)->name);
+        goto error;
+    }
+
+    /* Jobs updated timestamps of targets */
+    bake_filelist_refresh(targets);
+
+    /* Actions may have added files to directories */
+    if (run) {
+        bake_language_invalidateDirs(p);
+    }
+
+    corto_ll_free(jobs);
+    bake_node_free_timestamps(map.timestamps);
+    corto_mutex_free(&map.lock);
+
     return 0;
 error:
+    /* Free jobs that did not run */
+    it = corto_ll_iter(jobs);
+    while (corto_iter_hasNext(&it)) {
+        bake_rule_map_job *job = corto_iter_next(&it);
+        if (job->srcPath != job->src->name) {
+            free(job->srcPath);
+        }
+        free(job->dstPath);
+        free(job);
+    }
+    corto_ll_free(jobs);
+    bake_node_free_timestamps(map.timestamps);
+    corto_mutex_free(&map.lock);
     return -1;
 }
 
@@ -471,44 +1253,84 @@ int16_t bake_node_run_rule_pattern(
     bake_filelist *targets,
     bool shouldBuild)
 {
-    /* Do n-to-n comparison between sources and targets. If the
-     * target list is empty, it is possible that files still have to
-     * be generated, in which case the rule must be executed. */
+    bool newer = false;
+
+    /* Compare the newest source with the oldest target. If the target list
+     * is empty, it is possible that files still have to be generated, in
+     * which case the rule must be executed. */
     if (!shouldBuild) {
         if (!targets || !bake_filelist_count(targets)) {
             shouldBuild = true;
             corto_trace("no targets found for rule '%s', rebuilding",
                 ((bake_node*)r)->name);
-        } else {
-            corto_iter src_iter = bake_filelist_iter(inputs);
-            while (!shouldBuild && corto_iter_hasNext(&src_iter)) {
-                bake_file *src = corto_iter_next(&src_iter);
-
-                corto_iter dst_iter = bake_filelist_iter(targets);
-                while (!shouldBuild && corto_iter_hasNext(&dst_iter)) {
-                    bake_file *dst = corto_iter_next(&dst_iter);
-                    if (!src->timestamp) {
-                        shouldBuild = true;
-                        corto_trace("'%s' does not exist for '%s', rebuilding",
-                            dst->name,
-                            ((bake_node*)r)->name);
-                    } else if (src->timestamp > dst->timestamp) {
-                        shouldBuild = true;
-                        corto_trace("'%s' is newer than '%s', rebuilding",
-                            src->name,
-                            dst->name);
-                    }
-                }
+        } else if (inputs && bake_filelist_count(inputs)) {
+            if (inputs->missing) {
+                shouldBuild = true;
+                corto_trace("inputs do not exist for '%s', rebuilding",
+                    ((bake_node*)r)->name);
+            } else if (targets->missing) {
+                shouldBuild = true;
+                corto_trace("targets do not exist for '%s', rebuilding",
+                    ((bake_node*)r)->name);
+            } else if (inputs->newest > targets->oldest) {
+                newer = true;
+                corto_trace("inputs are newer than targets of '%s'",
+                    ((bake_node*)r)->name);
             }
         }
     }
 
     char *dst = NULL;
     if (bake_filelist_count(targets) == 1) {
-        bake_file *f = corto_ll_get(targets->files, 0);
+        bake_file *f = bake_filelist_get(targets, 0);
         dst = f->name;
     }
 
+    /* Outputs of rules without a single target are recorded by rule name */
+    char *output = dst ? corto_strdup(dst) : corto_asprintf("$%s", ((bake_node*)r)->name);
+    uint64_t signature = bake_node_signature(l, p, c, r);
+
+    /* The artefact in bin is linked with the libraries of used packages, so
+     * it is relinked when one of them changed */
+    if (dst && !strncmp(dst, "bin/", 4)) {
+        signature = bake_db_hash(signature, &p->use_hash, sizeof(p->use_hash));
+    }
+    uint64_t recorded_inputs = 0, recorded_signature = 0;
+    bool recorded = bake_db_output_get(
+        p->db, output, &recorded_inputs, &recorded_signature);
+
+    /* Rebuild if the settings that determine the command changed */
+    if (!shouldBuild && recorded && recorded_signature != signature) {
+        corto_trace("settings for '%s' changed, rebuilding", output);
+        shouldBuild = true;
+    }
+
+    uint64_t input_hash = 0;
+    if (inputs && bake_filelist_count(inputs) &&
+        (shouldBuild || newer || !recorded))
+    {
+        uint32_t count = bake_filelist_count(inputs), i = 0;
+        bake_file **files = corto_alloc(sizeof(bake_file*) * count);
+        corto_iter src_iter = bake_filelist_iter(inputs);
+        while (corto_iter_hasNext(&src_iter)) {
+            files[i ++] = corto_iter_next(&src_iter);
+        }
+        input_hash = bake_node_inputs_hash(p, files, count);
+        free(files);
+    }
+
+    /* Sources are newer than targets, check if their contents changed */
+    if (newer && !shouldBuild) {
+        if (input_hash && input_hash == recorded_inputs) {
+            corto_trace("inputs of '%s' did not change", output);
+        } else {
+            shouldBuild = true;
+        }
+    } else if (!shouldBuild && input_hash) {
+        /* Record inputs of targets built before they were tracked */
+        bake_db_output_set(p->db, output, input_hash, signature);
+    }
+
     if (shouldBuild && inputs && bake_filelist_count(inputs)) {
         corto_buffer source_list = CORTO_BUFFER_INIT;
         corto_iter src_iter = bake_filelist_iter(inputs);
@@ -543,39 +1365,134 @@ int16_t bake_node_run_rule_pattern(
         } else {
             p->freshly_baked = true;
             p->changed = true;
+            if (input_hash) {
+                bake_db_output_set(p->db, output, input_hash, signature);
+            }
+        }
+
+        /* Action updated the targets, so rules that use them as input must
+         * see the new timestamps */
+        if (targets) {
+            bake_filelist_update(targets);
         }
 
+        /* Action may have added files to directories */
+        bake_language_invalidateDirs(p);
+
         free(source_list_str);
     } else if (dst) {
         corto_trace("#[grey]%s", dst);
     }
 
+    free(output);
     return 0;
 error:
+    free(output);
     return -1;
 }
 
+/* Result of evaluating a node. A node can be reached through multiple paths
+ * in the rule graph, in which case the result of the first evaluation is
+ * reused. Results are valid for a single generate or build call. */
+typedef struct bake_node_result {
+    bake_node *node;
+    bake_filelist *inherits; /* NULL if result doesn't depend on inherits */
+    bake_filelist *targets;
+    bool owned; /* true if targets was created by the evaluation */
+} bake_node_result;
+
+static
+int bake_node_result_cmp(void *ctx, const void* key1, const void* key2) {
+    const bake_node_result *r1 = key1, *r2 = key2;
+    if (r1->node != r2->node) {
+        return (uintptr_t)r1->node < (uintptr_t)r2->node ? -1 : 1;
+    }
+    if (r1->inherits != r2->inherits) {
+        return (uintptr_t)r1->inherits < (uintptr_t)r2->inherits ? -1 : 1;
+    }
+    return 0;
+}
+
+static
+corto_rb bake_node_results_new(void)
+{
+    return corto_rb_new(bake_node_result_cmp, NULL);
+}
+
+static
+void bake_node_results_free(
+    corto_rb results)
+{
+    corto_iter it = corto_rb_iter(results);
+    while (corto_iter_hasNext(&it)) {
+        bake_node_result *r = corto_iter_next(&it);
+        if (r->owned && r->targets) {
+            bake_filelist_free(r->targets);
+        }
+        free(r);
+    }
+    corto_rb_free(results);
+}
+
+/* Patterns that match their own files don't depend on inherited targets */
+static
+bool bake_node_usesInherits(
+    bake_node *n,
+    bake_project *p)
+{
+    if (n->kind != BAKE_RULE_PATTERN) {
+        return true;
+    }
+    if (((bake_pattern*)n)->pattern) {
+        return false;
+    }
+    if (n->name && !stricmp(n->name, "SOURCES")) {
+        return false;
+    }
+    if (n->name && !stricmp(n->name, "MODEL") && p->model) {
+        return false;
+    }
+    return true;
+}
+
 static
 int16_t bake_node_eval(
     bake_language *l,
     bake_node *n,
     bake_project *p,
     bake_config *c,
+    corto_rb results,
     bake_filelist *inherits,
     bake_filelist *outputs)
 {
     bake_filelist *targets = NULL, *inputs = NULL;
+    bool owned = false;
 
     if (n->cond && !n->cond(p)) {
         return 0;
     }
 
+    /* If node was already evaluated, only add its targets to outputs */
+    bake_node_result key = {
+        .node = n,
+        .inherits = bake_node_usesInherits(n, p) ? inherits : NULL
+    };
+    bake_node_result *result = corto_rb_find(results, &key);
+    if (result) {
+        if (outputs && result->targets) {
+            bake_filelist_addList(outputs, result->targets);
+        }
+        return 0;
+    }
+
     corto_log_push((char*)n->name);
 
     if (n->kind == BAKE_RULE_PATTERN) {
         targets = bake_node_eval_pattern(n, p);
         if (!targets) {
             targets = inherits;
+        } else {
+            owned = true;
         }
     } else {
         corto_trace("evaluating rule");
@@ -584,7 +1501,7 @@ int16_t bake_node_eval(
 
     /* Collect input files for node */
     if (n->deps) {
-        bake_filelist *inputs = bake_filelist_new(NULL, NULL);
+        inputs = bake_filelist_new(p->path, NULL);
         if (!inputs) {
             corto_throw(NULL);
             goto error;
@@ -594,7 +1511,7 @@ int16_t bake_node_eval(
         corto_iter it = corto_ll_iter(n->deps);
         while (corto_iter_hasNext(&it)) {
             bake_node *e = corto_iter_next(&it);
-            if (bake_node_eval(l, e, p, c, targets, inputs)) {
+            if (bake_node_eval(l, e, p, c, results, targets, inputs)) {
                 corto_throw("dependency '%s' failed", e->name);
                 goto error;
             }
@@ -606,11 +1523,12 @@ int16_t bake_node_eval(
 
             /* When rule specifies a map, generate targets from inputs */
             if (r->target.kind == BAKE_RULE_TARGET_MAP) {
-                targets = bake_filelist_new(NULL, NULL);
+                targets = bake_filelist_new(p->path, NULL);
                 if (!targets) {
                     corto_throw(NULL);
                     goto error;
                 }
+                owned = true;
                 if (bake_node_run_rule_map(l, p, c, r, inputs, targets)) {
                     corto_throw(NULL);
                     goto error;
@@ -623,28 +1541,27 @@ int16_t bake_node_eval(
                 if (!r->target.is.pattern || (r->target.is.pattern[0] == '$' && inherits)) {
                     targets = inherits;
                 } else {
-                    char *pattern = corto_strdup(r->target.is.pattern);
-                    targets = bake_filelist_new(NULL, NULL);
+                    targets = bake_filelist_new(p->path, NULL);
+                    owned = true;
 
-                    char *tok = strtok(pattern, ",");
-                    while (tok) {
-                        bake_node *targetNode = bake_node_find(l, &tok[1]);
+                    corto_iter target_it = corto_ll_iter(r->target_nodes);
+                    while (corto_iter_hasNext(&target_it)) {
+                        bake_node *targetNode = corto_iter_next(&target_it);
                         if (!targetNode->cond || targetNode->cond(p)) {
                             bake_filelist *list = bake_filelist_new(
-                                NULL, ((bake_pattern*)targetNode)->pattern);
+                                p->path, ((bake_pattern*)targetNode)->pattern);
                             if (!list || !bake_filelist_count(list)) {
-                                corto_trace("no targets matched by '%s', need to rebuild '%s'",
-                                    tok,
+                                corto_trace("no targets matched by '$%s', need to rebuild '%s'",
+                                    targetNode->name,
                                     n->name);
                                 shouldBuild = true;
-                            } else {
+                            }
+                            if (list) {
                                 bake_filelist_addList(targets, list);
                                 bake_filelist_free(list);
                             }
                         }
-                        tok = strtok(NULL, ",");
                     }
-                    free(pattern);
                 }
 
                 if (!targets && !bake_filelist_count(inputs)) {
@@ -653,7 +1570,8 @@ int16_t bake_node_eval(
                 }
 
                 if (!targets) {
-                    targets = bake_filelist_new(NULL, NULL);
+                    targets = bake_filelist_new(p->path, NULL);
+                    owned = true;
                 }
 
                 if (bake_node_run_rule_pattern(l, p, c, r, inputs, targets, shouldBuild)) {
@@ -662,6 +1580,9 @@ int16_t bake_node_eval(
                 }
             }
         }
+
+        bake_filelist_free(inputs);
+        inputs = NULL;
     }
 
     /* Add targets to list of outputs (inputs for parent node) */
@@ -669,15 +1590,40 @@ int16_t bake_node_eval(
         bake_filelist_addList(outputs, targets);
     }
 
+    /* Store result, so node is not evaluated again in this build */
+    result = corto_alloc(sizeof(bake_node_result));
+    *result = key;
+    result->targets = targets;
+    result->owned = owned;
+    corto_rb_set(results, result, result);
+
     corto_trace("done");
     corto_log_pop();
 
     return 0;
 error:
+    if (inputs) bake_filelist_free(inputs);
+    if (owned && targets) bake_filelist_free(targets);
     corto_log_pop();
     return -1;
 }
 
+/* Load build database of project if not yet loaded */
+static
+int16_t bake_language_loadDb(
+    bake_project *p)
+{
+    if (!p->db) {
+        if (!(p->db = bake_db_load(p))) {
+            corto_throw("failed to load build database for '%s'", p->id);
+            goto error;
+        }
+    }
+    return 0;
+error:
+    return -1;
+}
+
 int16_t bake_language_generate(
     bake_language *l,
     bake_project *p,
@@ -694,7 +1640,24 @@ int16_t bake_language_generate(
 
         corto_tls_set(BAKE_PROJECT_KEY, p);
 
-        if (bake_node_eval(l, root, p, c, NULL, NULL)) {
+        if (bake_language_loadDb(p)) {
+            corto_log_pop();
+            goto error;
+        }
+
+        /* Save database also when failed, so completed work is recorded */
+        corto_rb results = bake_node_results_new();
+        p->dircache = bake_dircache_new(p->db);
+        int16_t ret = bake_node_eval(l, root, p, c, results, NULL, NULL);
+        bake_node_results_free(results);
+        bake_dircache_free(p->dircache);
+        p->dircache = NULL;
+        if (bake_db_save(p->db)) {
+            corto_warning("failed to save build database for '%s'", p->id);
+            corto_catch();
+        }
+
+        if (ret) {
             corto_log_pop();
             goto error;
         }
@@ -708,30 +1671,38 @@ error:
     return -1;
 }
 
-int16_t bake_language_build(
-    bake_language *l,
-    bake_project *p,
-    bake_config *c)
+/* Record contents of used packages after the artefact is built. A dependency
+ * that changed is reported as changed until the artefact was rebuilt. */
+static
+void bake_language_recordDependencies(
+    bake_project *p)
 {
-    char *artefact = NULL;
-    char *artefact_path = NULL;
-
-    corto_log_push("build");
-    corto_trace("begin");
-
-    /* If code generation yielded a folder with the name of the
-     * project language, this is a new project that contains the
-     * generated language binding api. */
-    if (p->use_generated_api && corto_file_test(p->language) == 1) {
-        int sig;
-        int8_t ret;
-        if ((sig = corto_proc_cmd(strarg("bake build %s", p->language), &ret)) || ret) {
-            corto_throw(NULL);
-            goto error;
+    corto_iter it = corto_ll_iter(p->use);
+    while (corto_iter_hasNext(&it)) {
+        char *package = corto_iter_next(&it);
+        uint64_t hash = bake_project_dependency_hash(p, package);
+        if (!hash) {
+            /* Without a record the dependency is compared by timestamp */
+            continue;
         }
+
+        char *output = corto_asprintf("use:%s", package);
+        bake_db_output_set(p->db, output, hash, 0);
+        free(output);
     }
+}
+
+/* Add libraries of dependencies to link list, and load dependee config of
+ * dependencies. Dependencies are located before the project is modified, so
+ * that a failed attempt does not leave entries that are added again by the
+ * next attempt. */
+static
+int16_t bake_language_loadDependencies(
+    bake_project *p)
+{
+    corto_ll link = corto_ll_new();
+    corto_ll dependees = corto_ll_new(); /* pairs of package, file */
 
-    /* Add dependencies to link list */
     corto_iter it = corto_ll_iter(p->use);
     while (corto_iter_hasNext(&it)) {
         char *dep = corto_iter_next(&it);
@@ -745,7 +1716,7 @@ int16_t bake_language_build(
 
         const char *lib = corto_locate(dep, NULL, CORTO_LOCATE_LIB);
         if (lib) {
-            corto_ll_append(p->link, corto_strdup(lib));
+            corto_ll_append(link, corto_strdup(lib));
         } else {
             /* A dependency may not have a library that can be linked, but could
              * only contain build instructions */
@@ -755,13 +1726,11 @@ int16_t bake_language_build(
         /* Check if dependency has a dependee file with build instructions */
         char *dependee_file = corto_asprintf("%s/dependee.json", libpath);
         if (corto_file_test(dependee_file)) {
-            if (bake_project_loadDependeeConfig(p, dep, dependee_file)) {
-                corto_throw(NULL);
-                goto error;
-            }
+            corto_ll_append(dependees, dep);
+            corto_ll_append(dependees, dependee_file);
+        } else {
+            free(dependee_file);
         }
-
-        free(dependee_file);
     }
 
     /* If project is managed, add corto library to link */
@@ -770,7 +1739,84 @@ int16_t bake_language_build(
         if (!cortolib) {
             goto error;
         }
-        corto_ll_append(p->link, corto_strdup(cortolib));
+        corto_ll_append(link, corto_strdup(cortolib));
+    }
+
+    /* All dependencies are located, add them to the project */
+    it = corto_ll_iter(link);
+    while (corto_iter_hasNext(&it)) {
+        corto_ll_append(p->link, corto_iter_next(&it));
+    }
+    corto_ll_free(link);
+    link = NULL;
+
+    /* Dependee configs add to the project as they are parsed, so they are
+     * never loaded twice, also when one of them fails to load */
+    p->dependencies_loaded = true;
+
+    int16_t result = 0;
+    it = corto_ll_iter(dependees);
+    while (corto_iter_hasNext(&it)) {
+        char *dep = corto_iter_next(&it);
+        char *dependee_file = corto_iter_next(&it);
+        if (!result && bake_project_loadDependeeConfig(p, dep, dependee_file)) {
+            corto_throw(NULL);
+            result = -1;
+        }
+        free(dependee_file);
+    }
+    corto_ll_free(dependees);
+
+    return result;
+error:
+    if (link) {
+        it = corto_ll_iter(link);
+        while (corto_iter_hasNext(&it)) {
+            free(corto_iter_next(&it));
+        }
+        corto_ll_free(link);
+    }
+    it = corto_ll_iter(dependees);
+    while (corto_iter_hasNext(&it)) {
+        corto_iter_next(&it);
+        free(corto_iter_next(&it));
+    }
+    corto_ll_free(dependees);
+    return -1;
+}
+
+int16_t bake_language_build(
+    bake_language *l,
+    bake_project *p,
+    bake_config *c)
+{
+    char *artefact = NULL;
+    char *artefact_path = NULL;
+
+    corto_log_push("build");
+    corto_trace("begin");
+
+    /* If code generation yielded a folder with the name of the
+     * project language, this is a new project that contains the
+     * generated language binding api. */
+    char *language_path = bake_project_file(p, p->language);
+    if (p->use_generated_api && corto_file_test(language_path) == 1) {
+        int sig;
+        int8_t ret;
+        if ((sig = bake_exec(p->path, strarg("bake build %s", p->language), NULL, &ret)) || ret) {
+            free(language_path);
+            corto_throw(NULL);
+            goto error;
+        }
+    }
+    free(language_path);
+
+    /* Add dependencies to link list. A project that is built more than once
+     * by the same process (like a daemon) only does this once. */
+    if (!p->dependencies_loaded) {
+        if (bake_language_loadDependencies(p)) {
+            goto error;
+        }
     }
 
     bake_node *root = bake_node_find(l, "ARTEFACT");
@@ -787,29 +1833,52 @@ int16_t bake_language_build(
 
     artefact_path = corto_asprintf("bin/%s-%s", CORTO_PLATFORM_STRING, c->id);
 
-    if (corto_mkdir(artefact_path)) {
+    char *artefact_dir = bake_project_file(p, artefact_path);
+    if (corto_mkdir(artefact_dir)) {
+        free(artefact_dir);
         corto_throw(NULL);
         goto error;
     }
+    free(artefact_dir);
 
     corto_tls_set(BAKE_PROJECT_KEY, p);
 
+    if (bake_language_loadDb(p)) {
+        goto error;
+    }
+
     /* Evaluate root node */
-    char *binaryPath = bake_project_binaryPath(p);
     bake_filelist *artefact_fl = bake_filelist_new(
-        binaryPath,
+        p->path,
         NULL
     );
     bake_filelist_add(artefact_fl, strarg("%s/%s", artefact_path, artefact));
-    if (bake_node_eval(l, root, p, c, artefact_fl, NULL)) {
+    corto_rb results = bake_node_results_new();
+    p->dircache = bake_dircache_new(p->db);
+    int16_t ret = bake_node_eval(l, root, p, c, results, artefact_fl, NULL);
+    bake_node_results_free(results);
+    bake_filelist_free(artefact_fl);
+    bake_dircache_free(p->dircache);
+    p->dircache = NULL;
+
+    /* Record with which contents of used packages the artefact was built */
+    if (!ret) {
+        bake_language_recordDependencies(p);
+    }
+
+    /* Save database also when failed, so completed work is recorded */
+    if (bake_db_save(p->db)) {
+        corto_warning("failed to save build database for '%s'", p->id);
+        corto_catch();
+    }
+
+    if (ret) {
         corto_throw("failed to build 'ARTEFACT'");
         goto error;
     }
-    bake_filelist_free(artefact_fl);
 
     free(artefact_path);
     free(artefact);
-    free(binaryPath);
 
     corto_log_pop();
     return 0;
@@ -831,6 +1900,18 @@ int16_t bake_language_init(
     return 0;
 }
 
+/* Remove file or directory relative to project */
+static
+int16_t bake_language_rm(
+    bake_project *p,
+    const char *file)
+{
+    char *path = bake_project_file(p, file);
+    int16_t result = corto_rm(path);
+    free(path);
+    return result;
+}
+
 int16_t bake_language_clean(
     bake_language *l,
     bake_project *p)
@@ -841,26 +1922,36 @@ int16_t bake_language_clean(
 
     corto_tls_set(BAKE_PROJECT_KEY, p);
 
+    /* The build database is stored in .bake_cache, so forget about it */
+    if (p->db) {
+        bake_db_free(p->db);
+        p->db = NULL;
+    }
+
     /* Clear .bake_cache directory which contains object files / generated files */
-    if (corto_rm(".bake_cache")) {
+    if (bake_language_rm(p, ".bake_cache")) {
         goto error;
     }
 
     /* Clear bin directory which contains the artefact */
-    if (corto_rm("bin")) {
+    if (bake_language_rm(p, "bin")) {
         goto error;
     }
 
     /* Clear .corto directory (for legacy projects) */
-    if (corto_rm(".corto")) {
+    if (bake_language_rm(p, ".corto")) {
         goto error;
     }
 
     /* If project is managed and contains a folder with the name of the
      * configured language, this is a project that contains generated
      * code. */
-    if (p->managed && p->language && corto_file_test(p->language) == 1) {
-        corto_rm(p->language);
+    if (p->managed && p->language) {
+        char *language_path = bake_project_file(p, p->language);
+        if (corto_file_test(language_path) == 1) {
+            corto_rm(language_path);
+        }
+        free(language_path);
     }
 
     /* If language binding registered callback to specify additional files
@@ -872,7 +1963,7 @@ int16_t bake_language_clean(
         corto_iter it = corto_ll_iter(p->files_to_clean);
         while (corto_iter_hasNext(&it)) {
             char *file = corto_iter_next(&it);
-            corto_rm(file);
+            bake_language_rm(p, file);
         }
     }
 
@@ -903,6 +1994,9 @@ bake_language* bake_language_get(
     bake_language *l = NULL;
     char *package = corto_asprintf("driver/bake/%s", language);
 
+    /* Projects may be built in parallel, protect list of loaded languages */
+    corto_mutex_lock(&BAKE_LANGUAGE_LOCK);
+
     if (!languages) {
         languages = corto_ll_new();
     }
@@ -932,6 +2026,8 @@ bake_language* bake_language_get(
         l->exec = bake_language_exec_cb;
 
         l->nodes = corto_ll_new();
+        l->node_index = corto_rb_new(bake_node_cmp, NULL);
+        l->dependency_rules = corto_ll_new();
         l->error = 0;
 
         corto_dl dl = NULL;
@@ -970,11 +2066,12 @@ bake_language* bake_language_get(
         corto_ll_append(languages, l);
     }
 
-    corto_ll_append(languages, l);
+    corto_mutex_unlock(&BAKE_LANGUAGE_LOCK);
 
     if (package) free(package);
     return l;
 error:
+    corto_mutex_unlock(&BAKE_LANGUAGE_LOCK);
     if (package) free(package);
     return NULL;
 }
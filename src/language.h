@@ -19,6 +19,6 @@
  * THE SOFTWARE.
  */
 
-/* Not thread safe */
+/* Thread safe */
 bake_language* bake_language_get(
     const char *language);
@@ -0,0 +1,170 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+static corto_rb matchers;
+static struct corto_mutex_s matchers_lock;
+
+static
+int bake_matcher_cmp(void *ctx, const void* key1, const void* key2) {
+    return strcmp(key1, key2);
+}
+
+static
+void bake_matcher_free(
+    bake_matcher m)
+{
+    if (m->program) corto_idmatch_free(m->program);
+    if (m->dir) free(m->dir);
+    free(m->filter);
+    free(m->pattern);
+    free(m);
+}
+
+/* Filters that only match file names, optionally in all subdirectories ('//'),
+ * are compiled. Other filters are evaluated by corto_dir_iter. */
+static
+const char* bake_matcher_leaf(
+    const char *filter,
+    bool *recursive_out)
+{
+    const char *leaf = filter;
+    bool recursive = false;
+
+    if (leaf[0] == '/') {
+        recursive = true;
+        leaf ++;
+        if (leaf[0] == '/') {
+            leaf ++;
+        }
+    }
+
+    if (!leaf[0] || strchr(leaf, '/')) {
+        return NULL;
+    }
+
+    *recursive_out = recursive;
+    return leaf;
+}
+
+static
+bake_matcher bake_matcher_compile(
+    const char *pattern)
+{
+    bake_matcher result = corto_calloc(sizeof(struct bake_matcher_s));
+    result->pattern = corto_strdup(pattern);
+
+    /* Extract static path from pattern, so that only files in the directory
+     * identified by the static path have to be evaluated */
+    const char *ptr = pattern, *end = pattern;
+    char ch;
+    while ((ch = *ptr)) {
+        if (ch == '/') {
+            if (ptr[1] == '/') {
+                end = ptr;
+                break;
+            } else {
+                end = ptr;
+            }
+        } else if (corto_idmatch_isOperator(ch)) {
+            break;
+        }
+        ptr ++;
+    }
+
+    if (end != pattern) {
+        result->dir = corto_strdup(pattern);
+        result->dir[end - pattern] = '\0';
+
+        if (end[-1] == '/') {
+            end --;
+        } else {
+            end ++;
+            if (!*end) {
+                end = "*";
+            }
+        }
+    }
+
+    result->filter = corto_strdup(end);
+    result->has_operators = corto_idmatch_hasOperators(result->filter);
+
+    const char *leaf = bake_matcher_leaf(result->filter, &result->recursive);
+    if (leaf) {
+        result->program = corto_idmatch_compile(leaf, true, true);
+        if (!result->program) {
+            corto_throw("invalid pattern '%s'", pattern);
+            goto error;
+        }
+    }
+
+    return result;
+error:
+    bake_matcher_free(result);
+    return NULL;
+}
+
+int16_t bake_matcher_init(void)
+{
+    if (corto_mutex_new(&matchers_lock)) {
+        goto error;
+    }
+    matchers = corto_rb_new(bake_matcher_cmp, NULL);
+    return 0;
+error:
+    return -1;
+}
+
+void bake_matcher_deinit(void)
+{
+    if (matchers) {
+        corto_iter it = corto_rb_iter(matchers);
+        while (corto_iter_hasNext(&it)) {
+            bake_matcher_free(corto_iter_next(&it));
+        }
+        corto_rb_free(matchers);
+        corto_mutex_free(&matchers_lock);
+        matchers = NULL;
+    }
+}
+
+bake_matcher bake_matcher_get(
+    const char *pattern)
+{
+    corto_mutex_lock(&matchers_lock);
+    bake_matcher result = corto_rb_find(matchers, pattern);
+    if (!result) {
+        result = bake_matcher_compile(pattern);
+        if (result) {
+            corto_rb_set(matchers, result->pattern, result);
+        }
+    }
+    corto_mutex_unlock(&matchers_lock);
+    return result;
+}
+
+bool bake_matcher_match(
+    bake_matcher m,
+    const char *name)
+{
+    return corto_idmatch_run(m->program, name);
+}
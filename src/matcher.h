@@ -0,0 +1,70 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section matcher Compiled patterns
+ * @brief Patterns that are parsed once, and reused for every directory and
+ *        project they are matched against.
+ *
+ * A pattern is split up in a static directory prefix and a filter that is
+ * matched against the files in that directory. Filters that only match file
+ * names (optionally in all subdirectories) are compiled into an idmatch
+ * program. Compiled patterns are cached for the lifetime of the process.
+ */
+
+typedef struct bake_matcher_s {
+    char *pattern;
+    char *dir; /* static directory prefix of pattern, NULL if none */
+    char *filter; /* filter for files in dir */
+    bool has_operators; /* if false, filter is the name of a single file */
+    bool recursive; /* filter applies to all subdirectories of dir */
+    corto_idmatch_program program; /* compiled filter, NULL if filter is not
+                                    * limited to file names */
+} *bake_matcher;
+
+/** Initialize pattern cache.
+ *
+ * @return 0 if success, -1 if failed.
+ */
+int16_t bake_matcher_init(void);
+
+/** Free all compiled patterns. */
+void bake_matcher_deinit(void);
+
+/** Get compiled pattern.
+ * The pattern is compiled when it is requested for the first time. The
+ * returned matcher is owned by the cache. This function is thread safe.
+ *
+ * @param pattern A pattern in idmatch format.
+ * @return The compiled pattern, or NULL if failed.
+ */
+bake_matcher bake_matcher_get(
+    const char *pattern);
+
+/** Test if file name matches compiled filter.
+ *
+ * @param m A matcher with a compiled filter.
+ * @param name The file name.
+ * @return true if the name matches, otherwise false.
+ */
+bool bake_matcher_match(
+    bake_matcher m,
+    const char *name);
@@ -0,0 +1,55 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Required for nanosecond fields in struct stat */
+#if defined(__linux__)
+#define _GNU_SOURCE
+#elif defined(__APPLE__)
+#define _DARWIN_C_SOURCE
+#endif
+
+#include "bake.h"
+#include <sys/stat.h>
+
+#define BAKE_NSEC (1000000000ull)
+
+uint64_t bake_mtime_stat(
+    const struct stat *st)
+{
+#if defined(__linux__)
+    return (uint64_t)st->st_mtim.tv_sec * BAKE_NSEC + st->st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    return (uint64_t)st->st_mtimespec.tv_sec * BAKE_NSEC +
+        st->st_mtimespec.tv_nsec;
+#else
+    return (uint64_t)st->st_mtime * BAKE_NSEC;
+#endif
+}
+
+uint64_t bake_mtime(
+    const char *path)
+{
+    struct stat st;
+    if (stat(path, &st)) {
+        return 0;
+    }
+    return bake_mtime_stat(&st);
+}
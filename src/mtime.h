@@ -0,0 +1,47 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section mtime File timestamps
+ * @brief Obtain modification times of files with nanosecond precision.
+ *
+ * Timestamps are expressed in nanoseconds since the epoch. Files that are
+ * modified within the same second as their inputs are therefore still ordered
+ * correctly, on filesystems that store sub-second timestamps.
+ */
+
+struct stat;
+
+/** Get modification time from file status.
+ *
+ * @param st File status, as obtained by stat.
+ * @return Modification time in nanoseconds.
+ */
+uint64_t bake_mtime_stat(
+    const struct stat *st);
+
+/** Get modification time of file.
+ *
+ * @param path Path to the file.
+ * @return Modification time in nanoseconds, or 0 if file does not exist.
+ */
+uint64_t bake_mtime(
+    const char *path);
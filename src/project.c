@@ -407,9 +407,9 @@ static
 int16_t bake_project_parseConfig(
     bake_project *p)
 {
-    const char *file = "project.json";
+    char *file = p->path ? bake_project_file(p, "project.json") : NULL;
 
-    if (corto_file_test("project.json")) {
+    if (file && corto_file_test(file)) {
         JSON_Value *j = json_parse_file(file);
         if (!j) {
             corto_throw("failed to parse '%s'", file);
@@ -464,8 +464,10 @@ int16_t bake_project_parseConfig(
         p->freshly_baked = true;
     }
 
+    if (file) free(file);
     return 0;
 error:
+    if (file) free(file);
     return -1;
 }
 
@@ -562,7 +564,11 @@ char *bake_project_modelFile(
     char *result = NULL;
     corto_iter it;
 
-    if (corto_dir_iter(".", NULL, &it)) {
+    if (!p->path) {
+        return NULL;
+    }
+
+    if (corto_dir_iter(p->path, NULL, &it)) {
         p->error = true;
         goto error;
     }
@@ -624,7 +630,14 @@ bake_project* bake_project_new(
     result->cfg = cfg;
 
     /* Default values */
-    result->path = path ? strdup(path) : NULL;
+    if (path && path[0] != '/') {
+        /* Projects are not built from their own directory, so make sure the
+         * path does not depend on the working directory */
+        result->path = corto_asprintf("%s/%s", corto_cwd(), path);
+        corto_path_clean(result->path, result->path);
+    } else {
+        result->path = path ? strdup(path) : NULL;
+    }
     result->public = true;
     result->managed = true;
     result->use_generated_api = true;
@@ -695,9 +708,21 @@ void bake_project_free(
     if (p->sources) corto_ll_free(p->sources);
     if (p->includes) corto_ll_free(p->includes);
     if (p->files_to_clean) corto_ll_free(p->files_to_clean);
+    if (p->db) bake_db_free(p->db);
     free(p);
 }
 
+char* bake_project_file(
+    bake_project *p,
+    const char *file)
+{
+    if (file[0] == '/') {
+        return corto_strdup(file);
+    } else {
+        return corto_asprintf("%s/%s", p->path, file);
+    }
+}
+
 char* bake_project_binaryPath(
     bake_project *p)
 {
@@ -771,3 +796,40 @@ void bake_project_use(
 
     corto_ll_append(p->use, corto_strdup(use));
 }
+
+uint64_t bake_project_dependency_hash(
+    bake_project *p,
+    const char *package)
+{
+    /* The library of a package changes when the package is rebuilt */
+    const char *lib = corto_locate(package, NULL, CORTO_LOCATE_LIB);
+    if (lib) {
+        return bake_db_file_hash(p->db, lib);
+    }
+
+    /* Packages without a library only provide headers and build instructions */
+    corto_catch();
+    const char *path = corto_locate(package, NULL, CORTO_LOCATE_PACKAGE);
+    if (!path) {
+        corto_catch();
+        return 0;
+    }
+
+    uint64_t hash = 0;
+    const char *files[] = {"dependee.json", "project.json"};
+    int i;
+    for (i = 0; i < 2; i ++) {
+        char *file = corto_asprintf("%s/%s", path, files[i]);
+        if (corto_file_test(file) == 1) {
+            uint64_t file_hash = bake_db_file_hash(p->db, file);
+            if (!file_hash) {
+                free(file);
+                return 0;
+            }
+            hash = bake_db_hash(hash, &file_hash, sizeof(file_hash));
+        }
+        free(file);
+    }
+
+    return hash;
+}
@@ -26,6 +26,11 @@ bake_project* bake_project_new(
 void bake_project_free(
     bake_project *p);
 
+/* Resolve file relative to project directory. Returns a new string. */
+char* bake_project_file(
+    bake_project *p,
+    const char *file);
+
 char* bake_project_binaryPath(
     bake_project *p);
 
@@ -50,6 +55,13 @@ void bake_project_use(
 char *bake_project_definitionFile(
     bake_project *p);
 
+/* Hash the contents of a used package: its library, or the dependee.json and
+ * project.json of packages without a library. Returns 0 if the package could
+ * not be read. */
+uint64_t bake_project_dependency_hash(
+    bake_project *p,
+    const char *package);
+
 int16_t bake_project_loadDependeeConfig(
     bake_project *p,
     const char *package_id,
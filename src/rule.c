@@ -30,6 +30,14 @@ bake_pattern* bake_pattern_new(
     result->super.name = name;
     result->super.cond = NULL;
     result->pattern = pattern ? corto_strdup(pattern) : NULL;
+
+    /* Compile pattern when the language is loaded, so that it is not parsed
+     * again for every project */
+    if (pattern && !bake_matcher_get(pattern)) {
+        corto_warning("failed to compile pattern '%s'", pattern);
+        corto_catch();
+    }
+
     return result;
 }
 
@@ -56,8 +64,9 @@ bake_dependency_rule* bake_dependency_rule_new(
     bake_rule_action_cb action)
 {
     bake_dependency_rule *result = corto_calloc(sizeof(bake_dependency_rule));
+    result->super.kind = BAKE_RULE_DEPENDENCY_RULE;
     result->super.name = name;
-    result->super.cond = NULL;    
+    result->super.cond = NULL;
     result->target = dep_mapping;
     result->deps = deps;
     result->action = action;
@@ -0,0 +1,489 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+/* Milliseconds without changes before changes are reported */
+#define BAKE_WATCH_SETTLE_TIME (100)
+
+#define BAKE_WATCH_DIR_MASK \
+    (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+struct bake_watch_s {
+    int fd;
+    corto_rb watches; /* watch descriptor -> bake_watch_entry */
+};
+
+/* Project that watches a directory */
+typedef struct bake_watch_user {
+    bake_project *p; /* valid for the lifetime of the watch */
+    bool config; /* project directory, only project.json is relevant */
+} bake_watch_user;
+
+typedef struct bake_watch_entry {
+    int wd;
+    char *dir; /* watched directory */
+    corto_ll users; /* projects that watch the directory */
+} bake_watch_entry;
+
+static
+int bake_watch_cmp(void *ctx, const void* key1, const void* key2) {
+    int wd1 = *(const int*)key1, wd2 = *(const int*)key2;
+    return wd1 < wd2 ? -1 : wd1 > wd2;
+}
+
+bake_watch bake_watch_new(void)
+{
+    int fd = inotify_init();
+    if (fd == -1) {
+        corto_throw("failed to initialize inotify: %s", strerror(errno));
+        goto error;
+    }
+
+    bake_watch result = corto_alloc(sizeof(struct bake_watch_s));
+    result->fd = fd;
+    result->watches = corto_rb_new(bake_watch_cmp, NULL);
+    return result;
+error:
+    return NULL;
+}
+
+static
+void bake_watch_entry_free(
+    bake_watch_entry *e)
+{
+    corto_iter it = corto_ll_iter(e->users);
+    while (corto_iter_hasNext(&it)) {
+        free(corto_iter_next(&it));
+    }
+    corto_ll_free(e->users);
+    free(e->dir);
+    free(e);
+}
+
+void bake_watch_free(
+    bake_watch w)
+{
+    corto_iter it = corto_rb_iter(w->watches);
+    while (corto_iter_hasNext(&it)) {
+        bake_watch_entry_free(corto_iter_next(&it));
+    }
+    corto_rb_free(w->watches);
+    close(w->fd);
+    free(w);
+}
+
+/* Test whether a subdirectory must not be watched. Hidden directories (like
+ * .bake_cache) and the bin directory of a project contain files written by
+ * builds, and watching them would rebuild projects after every build. */
+static
+bool bake_watch_ignore_dir(
+    bake_project *p,
+    const char *dir,
+    const char *name)
+{
+    if (name[0] == '.') {
+        return true;
+    }
+
+    return !strcmp(name, "bin") && !strcmp(dir, p->path);
+}
+
+/* Watch directory. Directories that are not project directories are watched
+ * with their subdirectories. A directory can be watched by multiple projects,
+ * for example when projects share an include directory. */
+static
+int16_t bake_watch_dir(
+    bake_watch w,
+    bake_project *p,
+    const char *dir,
+    bool config)
+{
+    uint32_t mask = BAKE_WATCH_DIR_MASK;
+    if (!config) {
+        mask |= IN_ONLYDIR;
+    }
+
+    int wd = inotify_add_watch(w->fd, dir, mask);
+    if (wd == -1) {
+        corto_throw("failed to watch '%s': %s", dir, strerror(errno));
+        goto error;
+    }
+
+    bake_watch_entry *e = corto_rb_find(w->watches, &wd);
+    if (!e) {
+        e = corto_alloc(sizeof(bake_watch_entry));
+        e->wd = wd;
+        e->dir = corto_strdup(dir);
+        e->users = corto_ll_new();
+        corto_rb_set(w->watches, &e->wd, e);
+    }
+
+    bake_watch_user *u = NULL;
+    corto_iter it = corto_ll_iter(e->users);
+    while (corto_iter_hasNext(&it)) {
+        bake_watch_user *cur = corto_iter_next(&it);
+        if (cur->p == p) {
+            u = cur;
+            break;
+        }
+    }
+
+    if (!u) {
+        u = corto_alloc(sizeof(bake_watch_user));
+        u->p = p;
+        u->config = config;
+        corto_ll_append(e->users, u);
+    } else if (!config) {
+        /* The same directory can be a project directory and a source or
+         * include directory, in which case all changes are relevant */
+        u->config = false;
+    }
+
+    if (!config) {
+        if (corto_dir_iter(dir, NULL, &it)) {
+            goto error;
+        }
+
+        while (corto_iter_hasNext(&it)) {
+            char *file = corto_iter_next(&it);
+            if (bake_watch_ignore_dir(p, dir, file)) {
+                continue;
+            }
+
+            char *subdir = corto_asprintf("%s/%s", dir, file);
+            if (corto_isdir(subdir)) {
+                if (bake_watch_dir(w, p, subdir, false)) {
+                    free(subdir);
+                    corto_iter_release(&it);
+                    goto error;
+                }
+            }
+            free(subdir);
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+static
+int16_t bake_watch_list(
+    bake_watch w,
+    bake_project *p,
+    corto_ll dirs)
+{
+    corto_iter it = corto_ll_iter(dirs);
+    while (corto_iter_hasNext(&it)) {
+        char *dir = corto_iter_next(&it);
+        char *path = bake_project_file(p, dir);
+
+        /* Clean path, so files resolve to the names in the build database */
+        corto_path_clean(path, path);
+        if (corto_isdir(path)) {
+            if (bake_watch_dir(w, p, path, false)) {
+                free(path);
+                goto error;
+            }
+        }
+        free(path);
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int16_t bake_watch_add(
+    bake_watch w,
+    bake_project *p)
+{
+    /* Project directory is watched for changes to project.json */
+    if (bake_watch_dir(w, p, p->path, true)) {
+        goto error;
+    }
+
+    if (bake_watch_list(w, p, p->sources)) {
+        goto error;
+    }
+
+    if (bake_watch_list(w, p, p->includes)) {
+        goto error;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+static
+void bake_watch_addChanged(
+    corto_ll changed,
+    const char *project)
+{
+    corto_iter it = corto_ll_iter(changed);
+    while (corto_iter_hasNext(&it)) {
+        if (!strcmp(corto_iter_next(&it), project)) {
+            return;
+        }
+    }
+    corto_ll_append(changed, corto_strdup(project));
+}
+
+/* Test whether a file changed since the last build of a project read it.
+ * Files written by the build have the contents the build used, and files
+ * that are outputs of the build are not inputs, so these are not reported. */
+static
+bool bake_watch_file_changed(
+    bake_project *p,
+    const char *dir,
+    const char *name)
+{
+    if (!p->db) {
+        return true;
+    }
+
+    char *path = corto_asprintf("%s/%s", dir, name);
+    const char *file = path;
+    size_t len = strlen(p->path);
+    if (!strncmp(path, p->path, len) && path[len] == '/') {
+        file = path + len + 1;
+    }
+
+    bool result = !bake_db_output_get(p->db, file, NULL, NULL) &&
+        bake_db_file_changed(p->db, file);
+    free(path);
+    return result;
+}
+
+/* Handle event in a directory watched by a project */
+static
+void bake_watch_event(
+    bake_watch w,
+    bake_watch_entry *e,
+    bake_watch_user *u,
+    struct inotify_event *ev,
+    corto_ll changed,
+    bool *config_changed,
+    bool built)
+{
+    bake_project *p = u->p;
+
+    if (u->config) {
+        if (!strcmp(ev->name, "project.json")) {
+            *config_changed = true;
+            bake_watch_addChanged(changed, p->path);
+        }
+        return;
+    }
+
+    /* Ignore hidden files, which are often temporary files of editors */
+    if (ev->name[0] == '.') {
+        return;
+    }
+
+    if (!strcmp(e->dir, p->path) && !strcmp(ev->name, "project.json")) {
+        *config_changed = true;
+    }
+
+    if (ev->mask & IN_ISDIR) {
+        if (bake_watch_ignore_dir(p, e->dir, ev->name)) {
+            return;
+        }
+
+        /* Watch new subdirectories */
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+            char *subdir = corto_asprintf("%s/%s", e->dir, ev->name);
+            if (bake_watch_dir(w, p, subdir, false)) {
+                corto_warning("failed to watch new directory '%s'", subdir);
+                corto_catch();
+            }
+            free(subdir);
+        }
+    } else if (built && !bake_watch_file_changed(p, e->dir, ev->name)) {
+        return;
+    }
+
+    corto_trace("'%s/%s' changed", e->dir, ev->name);
+    bake_watch_addChanged(changed, p->path);
+}
+
+/* Read available events, and add projects that changed. If built is true,
+ * events for files that did not change since they were built are ignored. */
+static
+int16_t bake_watch_read(
+    bake_watch w,
+    corto_ll changed,
+    bool *config_changed,
+    bool built)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    ssize_t n = read(w->fd, buf, sizeof(buf));
+    if (n == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        corto_throw("failed to read file events: %s", strerror(errno));
+        goto error;
+    }
+
+    char *ptr = buf;
+    while (ptr < buf + n) {
+        struct inotify_event *ev = (struct inotify_event*)ptr;
+        ptr += sizeof(struct inotify_event) + ev->len;
+
+        if (ev->mask & IN_Q_OVERFLOW) {
+            /* Events were lost, so rebuild everything */
+            corto_iter it = corto_rb_iter(w->watches);
+            while (corto_iter_hasNext(&it)) {
+                bake_watch_entry *e = corto_iter_next(&it);
+                corto_iter user_it = corto_ll_iter(e->users);
+                while (corto_iter_hasNext(&user_it)) {
+                    bake_watch_user *u = corto_iter_next(&user_it);
+                    bake_watch_addChanged(changed, u->p->path);
+                }
+            }
+            continue;
+        }
+
+        bake_watch_entry *e = corto_rb_find(w->watches, &ev->wd);
+        if (!e || !ev->len) {
+            continue;
+        }
+
+        /* Watching a new subdirectory can add users to the list while it is
+         * iterated, so iterate over the users that were registered before */
+        int i, count = corto_ll_count(e->users);
+        for (i = 0; i < count; i ++) {
+            bake_watch_event(w, e, corto_ll_get(e->users, i), ev, changed,
+                config_changed, built);
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int16_t bake_watch_wait(
+    bake_watch w,
+    corto_ll changed_out,
+    bool *config_changed_out)
+{
+    struct pollfd pfd = {.fd = w->fd, .events = POLLIN};
+
+    *config_changed_out = false;
+
+    /* Wait for changes, then wait until no changes happen for a while */
+    while (!corto_ll_count(changed_out)) {
+        int timeout = -1;
+        for (;;) {
+            int ret = poll(&pfd, 1, timeout);
+            if (ret == -1 && errno == EINTR) {
+                continue;
+            } else if (ret == -1) {
+                corto_throw("failed to wait for file events: %s", strerror(errno));
+                goto error;
+            } else if (!ret) {
+                break;
+            }
+
+            if (bake_watch_read(w, changed_out, config_changed_out, false)) {
+                goto error;
+            }
+
+            if (!corto_ll_count(changed_out)) {
+                /* Irrelevant events, keep waiting for changes */
+                continue;
+            }
+
+            timeout = BAKE_WATCH_SETTLE_TIME;
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int16_t bake_watch_pending(
+    bake_watch w,
+    corto_ll changed_out,
+    bool *config_changed_out)
+{
+    struct pollfd pfd = {.fd = w->fd, .events = POLLIN};
+
+    while (poll(&pfd, 1, 0) > 0) {
+        if (bake_watch_read(w, changed_out, config_changed_out, true)) {
+            goto error;
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+#else
+
+bake_watch bake_watch_new(void)
+{
+    corto_throw("watching projects is not supported on this platform");
+    return NULL;
+}
+
+void bake_watch_free(
+    bake_watch w)
+{
+}
+
+int16_t bake_watch_add(
+    bake_watch w,
+    bake_project *p)
+{
+    return -1;
+}
+
+int16_t bake_watch_wait(
+    bake_watch w,
+    corto_ll changed_out,
+    bool *config_changed_out)
+{
+    return -1;
+}
+
+int16_t bake_watch_pending(
+    bake_watch w,
+    corto_ll changed_out,
+    bool *config_changed_out)
+{
+    return -1;
+}
+
+#endif
@@ -0,0 +1,86 @@
+/* Copyright (c) 2010-2018 the corto developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section watch Watch API
+ * @brief Waits for changes in the sources, includes and configuration of
+ *        projects.
+ *
+ * Changes are reported per project, so that only projects that changed (and
+ * the projects that depend on them) have to be rebuilt. Watching is only
+ * supported on Linux, where it is implemented with inotify.
+ */
+
+typedef struct bake_watch_s* bake_watch;
+
+/** Create a new watch.
+ *
+ * @return The new watch, or NULL if failed.
+ */
+bake_watch bake_watch_new(void);
+
+/** Free a watch.
+ *
+ * @param w The watch.
+ */
+void bake_watch_free(
+    bake_watch w);
+
+/** Watch sources, includes and project.json of a project.
+ * Hidden directories and the bin directory of the project are not watched,
+ * as builds write to them. A directory may be watched by multiple projects.
+ *
+ * @param w The watch.
+ * @param p The project.
+ * @return 0 if success, -1 if failed.
+ */
+int16_t bake_watch_add(
+    bake_watch w,
+    bake_project *p);
+
+/** Wait for changes.
+ * When a change is detected, this function waits until no more changes occur
+ * for a short period, so that changes to multiple files are handled at once.
+ *
+ * @param w The watch.
+ * @param changed_out List to which the paths of changed projects are added.
+ * @param config_changed_out Set to true if a project.json changed.
+ * @return 0 if success, -1 if failed.
+ */
+int16_t bake_watch_wait(
+    bake_watch w,
+    corto_ll changed_out,
+    bool *config_changed_out);
+
+/** Read changes made while building, without waiting.
+ * Files that were written by the build itself have the contents with which
+ * the build used them, so these are not reported. Files that were changed
+ * after the build read them, or that the build did not read, are reported.
+ *
+ * @param w The watch.
+ * @param changed_out List to which the paths of changed projects are added.
+ * @param config_changed_out Set to true if a project.json changed.
+ * @return 0 if success, -1 if failed.
+ */
+int16_t bake_watch_pending(
+    bake_watch w,
+    corto_ll changed_out,
+    bool *config_changed_out);